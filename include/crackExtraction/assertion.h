@@ -0,0 +1,20 @@
+#ifndef ASSERTION_H
+
+#define ASSERTION_H
+
+#include <cstdio>
+#include <cstdlib>
+
+// assertion macros, kept apart from utils.h so that light headers can use them
+#define ASSERT_(Expr, Msg, ...)                                      \
+    if (!(Expr)) {                                                   \
+        std::printf("Assert failed:\t\n");                           \
+        std::printf("Expected:\t%s\n", #Expr);                       \
+        std::printf("Source:\t\t%s, line %d\n", __FILE__, __LINE__); \
+        std::printf(Msg, ##__VA_ARGS__);                             \
+        std::abort();                                                \
+    }
+
+#define ASSERT(Expr) ASSERT_(Expr, " \b")
+
+#endif
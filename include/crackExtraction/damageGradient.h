@@ -4,16 +4,27 @@
 
 #include <cmath>
 
+#include "crackExtraction/damageGrid.h"
 #include "crackExtraction/particles.h"
 #include "crackExtraction/utils.h"
 #include "crackExtraction/weights.h"
 
-// calculate the damage gradient of all particles and grid nodes.
-void calDamageGradient(std::vector<Particle>*, parametersSim, double, std::map<int, int>*, std::vector<Grid>*);
+// calculate the damage value of all grid nodes with the interpolation kernel chosen in the parameters. The particles' damage gradients are only calculated if the last argument
+// is given, the grid nodes' damage gradients by calNodeDamageGradient(). "real" is double, or float for the single
+// precision extraction
+template <class real>
+void calDamageGradient(std::vector<DamageParticleT<real>>*, parametersSim, double, DamageGridT<real>*, std::vector<Eigen::Matrix<real, 3, 1>>* deltaD = nullptr);
+
+// Calculate the damage gradient of all grid nodes after calDamageGradient(), with all threads. Call it before reading
+// the gradients through DamageGridT::deltaDi(), outside of a parallel region
+template <class real>
+void calNodeDamageGradient(DamageGridT<real>*, parametersSim, double);
 
 // calculate the damage gradient of any give point
-Eigen::Vector3d calDamageGradientPoint(Eigen::Vector3d, parametersSim, double, std::map<int, int>*, std::vector<Grid>*);
+template <class real>
+Eigen::Vector3d calDamageGradientPoint(Eigen::Vector3d, parametersSim, double, DamageGridT<real>*);
 
-double calDamageValuePoint(Eigen::Vector3d pos, parametersSim param, double dx, std::map<int, int>* gridMap, std::vector<Grid>* nodesVec);
+template <class real>
+double calDamageValuePoint(Eigen::Vector3d pos, parametersSim param, double dx, DamageGridT<real>* grid);
 
 #endif
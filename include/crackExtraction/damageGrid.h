@@ -0,0 +1,121 @@
+#ifndef DAMAGEGRID_H
+
+#define DAMAGEGRID_H
+
+#include "crackExtraction/nodeHashMap.h"
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+
+// Block-sparse damage field. Nodes are located through dense bricks of 4x4x4 nodes which are allocated on demand, so
+// the 3x3x3 stencil of a particle or query point touches one or a few bricks. Nodes are numbered 0, 1, 2, ... in the
+// order they are activated and their fields are stored as structure of arrays indexed by this id. The damage fields are
+// stored as "real", double or float for the single precision extraction.
+template <class real>
+class DamageGridT {
+public:
+    typedef Eigen::Matrix<real, 3, 1> vector3; // a gradient in the precision of the grid
+
+    static const int brickBits = 2;
+    static const int brickSize = 1 << brickBits; // nodes per brick edge
+    static const int brickNodes = brickSize * brickSize * brickSize; // nodes per brick
+
+    // Occupancy channels. A node's label in a channel is 0 outside the channel's region, 1 inside it and 1 + d for the
+    // nodes at distance d around the region which are added by dilate()
+    static const int fullyDamagedChannel = 0; // nodes touched by fully damaged particles
+    static const int allParticlesChannel = 1; // nodes touched by any particle
+    static const int numChannels = 2;
+
+    // A brick of the index: the id of each of its nodes
+    struct DamageBrick {
+        Eigen::Vector3i origin = { 0, 0, 0 }; // index of the brick's first node
+        uint64_t activeMask = 0; // bit s is set if node s is active
+        int nodeId[brickNodes]; // id of each active node
+    };
+
+    // node id of a node, -1 if the node is not active
+    int find(const Eigen::Vector3i& index) const
+    {
+        int b = brickMap.find(brickKey(index));
+        return b == -1 ? -1 : bricks[b].nodeId[slot(index)];
+    }
+
+    // node ids of the width x width x width stencil starting at "base", ids[(i * width + j) * width + k] for node
+    // base + (i, j, k). Each brick overlapping the stencil is looked up once. Inactive nodes get -1. The stencil may be
+    // 2 to 4 nodes wide
+    template <int width>
+    void findStencil(const Eigen::Vector3i& base, int* ids) const;
+
+    // Activate a node and return its id. The node's damage fields and labels are zero when it is activated. "inserted" is set to
+    // whether the node was inactive before
+    int activate(const Eigen::Vector3i& index, bool* inserted = nullptr);
+
+    // active nodes have the ids 0 to numNodes() - 1
+    int numNodes() const { return (int)posIndices.size(); }
+
+    // number of allocated bricks
+    int numBricks() const { return (int)bricks.size(); }
+
+    const Eigen::Vector3i& posIndex(int id) const { return posIndices[id]; }
+    real& Di(int id) { return DiValues[id]; }
+    real Di(int id) const { return DiValues[id]; }
+    real& sw(int id) { return swValues[id]; }
+    real sw(int id) const { return swValues[id]; }
+    vector3& deltaDi(int id) { return deltaDiValues[id]; }
+    const vector3& deltaDi(int id) const { return deltaDiValues[id]; }
+
+    // The damage gradient is only stored once it is computed, see calNodeDamageGradient(). It is dropped when the
+    // damage field is recomputed and becomes stale when nodes are activated
+    bool hasGradient() const { return deltaDiValues.size() == posIndices.size(); }
+    void allocateGradient() { deltaDiValues.assign(posIndices.size(), vector3::Zero()); }
+    void clearGradient() { std::vector<vector3>().swap(deltaDiValues); }
+    unsigned char& label(int channel, int id) { return labelValues[channel][id]; }
+    unsigned char label(int channel, int id) const { return labelValues[channel][id]; }
+
+    // Label the nodes within "numShells" nodes of a channel's region (label 1 nodes), measured in the maximum norm, with
+    // 1 + their distance to the region. Missing nodes are activated brick by brick, in increasing slot order. The region
+    // is dilated as one 64-bit occupancy mask per brick, one node per step with shifts along the three axes
+    void dilate(int channel, int numShells);
+
+    // make room for n nodes
+    void reserve(int n);
+
+private:
+    // the brick containing a node. The shifts round towards negative infinity, so negative indices work as well
+    static Eigen::Vector3i brickIndex(const Eigen::Vector3i& index) { return Eigen::Vector3i(index[0] >> brickBits, index[1] >> brickBits, index[2] >> brickBits); }
+    static uint64_t brickKey(const Eigen::Vector3i& index) { return NodeHashMap::key(brickIndex(index)); }
+
+    // position of a node inside its brick
+    static int slot(const Eigen::Vector3i& index)
+    {
+        const int m = brickSize - 1;
+        return (index[0] & m) | ((index[1] & m) << brickBits) | ((index[2] & m) << (2 * brickBits));
+    }
+
+    // position of a brick in "bricks", the brick is allocated if needed
+    int allocateBrick(const Eigen::Vector3i& brick);
+
+    // activate node "s" of brick "b" and return its id
+    int activateSlot(int b, int s, bool* inserted);
+
+    // grow the occupancy masks of all bricks by one node along an axis
+    void dilateMasks(int axis, std::vector<uint64_t>* masks);
+
+    NodeHashMap brickMap; // brick coordinates to position in "bricks"
+    std::vector<DamageBrick> bricks;
+    uint64_t lastBrickKey = ~uint64_t(0); // the brick used by the last activation, consecutive activations mostly hit it
+    int lastBrick = -1;
+
+    // fields of the nodes, indexed by node id
+    std::vector<Eigen::Vector3i> posIndices;
+    std::vector<real> DiValues;
+    std::vector<real> swValues;
+    std::vector<vector3> deltaDiValues;
+    std::vector<unsigned char> labelValues[numChannels];
+};
+
+typedef DamageGridT<double> DamageGrid;
+typedef DamageGridT<float> DamageGridF;
+
+#endif
@@ -3,8 +3,11 @@
 #define EXTRACTCRACK_H
 
 #include "crackExtraction/damageGradient.h"
+#include "crackExtraction/mortonOrder.h"
+#include "crackExtraction/nodeHashMap.h"
 #include "crackExtraction/particles.h"
 #include "crackExtraction/utils.h"
+#include "crackExtraction/voronoiTessellation.h"
 #include "crackExtraction/weights.h"
 #include "voro++.hh"
 #include <algorithm>
@@ -19,40 +22,12 @@
 // read obj file
 struct meshObjFormat readObj(std::string path);
 
-// Struct of particles
-struct Point {
-    int index = 0; // index of each point
-    Eigen::Vector3d pos = { 0, 0, 0 }; // each point's position
-    int numVertices = 0; // number of vertices
-    std::vector<Eigen::Vector3d> verticsCoor; // vertices' coordinate
-    int numFaces = 0; // number of faces
-    std::vector<std::vector<int>> verticesFace; // vertices of each face
-    std::vector<Eigen::Vector3d> surfaceNormal; // vertices' coordinate
-    std::vector<int> neighbour; // neighbour points that share common faces with this point
-    std::vector<int> neighbourCalculated; // neighbour points that have already find shared face
-
-    std::vector<int> neighbourSameSide; // neighbour points that are on the same side with this point
-    std::vector<int> neighbourOtherSide; // neighbour points that are on the other side with this point
-
-    Point(int iindex, Eigen::Vector3d ipos, int inumVertices, std::vector<Eigen::Vector3d> iverticsCoor, int inumFaces, std::vector<std::vector<int>> iverticesFace, std::vector<Eigen::Vector3d> isurfaceNormal, std::vector<int> ineighbour)
-        : index(iindex)
-        , pos(ipos)
-        , numVertices(inumVertices)
-        , verticsCoor(iverticsCoor)
-        , numFaces(inumFaces)
-        , verticesFace(iverticesFace)
-        , surfaceNormal(isurfaceNormal)
-        , neighbour(ineighbour)
-    {
-    }
-};
-
 // User-defined wall of Voro++
+template <class real>
 class wallShell : public voro::wall {
 public:
-    wallShell(std::map<int, int>* igridMap, std::vector<Grid>* inodesVec, struct parametersSim iparam, int iw_id = -99)
-        : gridMap(igridMap)
-        , nodesVec(inodesVec)
+    wallShell(DamageGridT<real>* igrid, struct parametersSim iparam, int iw_id = -99)
+        : grid(igrid)
         , param(iparam)
         , w_id(iw_id) {};
 
@@ -63,13 +38,13 @@ public:
         Eigen::Vector3d pos = { x, y, z };
         Eigen::Vector3i ppIndex = { 0, 0, 0 };
 
-        int numDamage = (*nodesVec).size();
+        int numDamage = (*grid).numNodes();
         for (int k = 0; k < numDamage; k++) {
-            Eigen::Vector3d nodePos = (*nodesVec)[k].posIndex.cast<double>() * param.dx;
+            Eigen::Vector3d nodePos = (*grid).posIndex(k).template cast<double>() * param.dx;
             double diff = (nodePos - pos).norm();
 
             if (diff <= 0.00001) {
-                ppIndex = (*nodesVec)[k].posIndex;
+                ppIndex = (*grid).posIndex(k);
                 goto stop0;
             }
         }
@@ -91,11 +66,10 @@ public:
                     }
 
                     Eigen::Vector3i nodePosIndex = ppIndex + normal;
-                    int ID = calculateID(nodePosIndex[0], nodePosIndex[1], nodePosIndex[2], param.length, param.dx);
-                    if ((*gridMap).find(ID) != (*gridMap).end()) // if this point is a neighbour of a fully damaged particle(the distance is smaller than dx)
+                    int eid = (*grid).find(nodePosIndex);
+                    if (eid != -1) // if this point is a neighbour of a fully damaged particle(the distance is smaller than dx)
                     {
-                        int eid = (*gridMap)[ID];
-                        if ((*nodesVec)[eid].Di == 2) // cannot be shell particles
+                        if ((*grid).label(DamageGrid::fullyDamagedChannel, eid) == 2) // cannot be shell particles
                         {
                             inside = true;
                             goto stop1;
@@ -132,10 +106,9 @@ public:
 
                     Eigen::Vector3i nodePosIndex = ppIndex + normal;
 
-                    int ID = calculateID(nodePosIndex[0], nodePosIndex[1], nodePosIndex[2], param.length, param.dx);
-                    if ((*gridMap).find(ID) != (*gridMap).end()) {
-                        int eid = (*gridMap)[ID];
-                        if ((*nodesVec)[eid].Di == 3) // if this node is a boundary shell
+                    int eid = (*grid).find(nodePosIndex);
+                    if (eid != -1) {
+                        if ((*grid).label(DamageGrid::fullyDamagedChannel, eid) == 3) // if this node is a boundary shell
                         {
                             Eigen::Vector3d posNodeOther = normal.cast<double>() * 2 * param.dx;
                             bool tempCut = c.nplane(posNodeOther[0], posNodeOther[1], posNodeOther[2], w_id);
@@ -164,47 +137,44 @@ public:
 
 private:
     const int w_id;
-    std::map<int, int>* gridMap;
-    std::vector<Grid>* nodesVec;
+    DamageGridT<real>* grid;
     struct parametersSim param;
 };
 
 // split a line from a text file
 std::vector<std::string> split(const std::string&, const std::string&);
 
-// Set the damage phase of a grid node std::vector into a specific value
-void setNodeValue(std::vector<Grid>*, int);
-
-// Find the bounding box boundary nodes and set its damage phase into a specific value
-void findBoundaryNodes(std::vector<Particle>*, std::vector<Grid>*, std::map<int, int>*, struct parametersSim, int);
-
-// Read particles' positions and damage phases
-void readParticles(std::string, std::vector<Particle>*, bool, struct parametersSim);
+// Label the nodes touched by the particles in the occupancy channels of the grid
+template <class real>
+void setOccupancy(DamageGridT<real>*);
 
 // Calculate the damage value of any point and return the value
-double ifFullyDamaged(Eigen::Vector3d, parametersSim, std::map<int, int>*, std::vector<Grid>*);
+template <class real>
+double ifFullyDamaged(Eigen::Vector3d, parametersSim, DamageGridT<real>*);
 
 // Store the index of each vertex and its position
 int findIndexVertex(Eigen::Vector3d, std::vector<Eigen::Vector3d>*);
 
-// Read all structured nodes and calculate the damage gradient
-void readParticlesAndCalGradient(std::string, std::vector<Particle>*, parametersSim, std::map<int, int>*, std::vector<Grid>*);
-
-// Find paths between two nodes
-bool findPath(Eigen::Vector3d, Eigen::Vector3d, parametersSim, std::vector<Grid>*, std::map<int, int>*, std::vector<int>*);
+// Smooth the fully damaged region onto the grid nodes, the result is used by ifFullyDamaged
+template <class real>
+void smoothFullyDamaged(DamageGridT<real>*, parametersSim);
 
 // Find if a pair of nodes belong to critical nodes. The function return true if one node is a critical node
-bool ifCriticalNode(Eigen::Vector3d, parametersSim, std::vector<int>*);
+bool ifCriticalNode(Eigen::Vector3d, parametersSim, NodeHashMap*);
 
 // Find the nearest boundary node of a critical node
-Eigen::Vector3i findNearestBoundaryNode(int, std::vector<Point>*, std::vector<int>*, std::vector<Eigen::Vector3i>*, std::map<int, int>*, parametersSim, std::vector<int>*);
+Eigen::Vector3i findNearestBoundaryNode(int, std::vector<Eigen::Vector3i>*, NodeHashMap*, parametersSim, NodeHashMap*);
 
-// Judge if a pair of points are on different sides of a crack
-bool ifTwoSides(int, int, std::vector<Point>*, std::vector<int>*, std::vector<Eigen::Vector3i>*, std::map<int, int>*, parametersSim, std::vector<int>*);
+// Judge if a pair of points are on different sides of a crack, given the neighbours already found on the same and on
+// the other side of each point
+bool ifTwoSides(int, int, NeighbourLists*, NeighbourLists*, std::vector<Eigen::Vector3i>*, NodeHashMap*, parametersSim, NodeHashMap*);
 
 // Extract the crack surface
+// all particles are transferred to the damage grid in one sweep, the particles whose damage is 1 (see ingestParticles)
+// make up the fully damaged region, which is labelled in its own occupancy channel of the same grid
 // if a crack surface is found, the crack surface with partial cut, the crack surface with full cut,  each fragment volume in .obj format
-std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extractCrackSurface(std::vector<Particle>* particlesRaw, struct parametersSim param);
+// the extraction runs in single precision if param.singlePrecision is set
+std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extractCrackSurface(std::vector<DamageParticle>* allParticles, struct parametersSim param);
 
 ////////////////////////////////
 // cut objects with ftetwild
@@ -0,0 +1,54 @@
+#ifndef MORTONORDER_H
+
+#define MORTONORDER_H
+
+#include "crackExtraction/particles.h"
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+
+// Morton (Z-order) code of a grid node. The bits of the three coordinates are interleaved, so nodes that are close in
+// space mostly get close codes. Each coordinate must lie in [-2^20, 2^20)
+inline uint64_t mortonCode(const Eigen::Vector3i& index)
+{
+    uint64_t code[3];
+    for (int d = 0; d < 3; d++) {
+        // spread the 21 bits of the biased coordinate to every third bit
+        uint64_t x = uint64_t(int64_t(index[d]) + (int64_t(1) << 20)) & 0x1fffff;
+        x = (x | (x << 32)) & UINT64_C(0x001f00000000ffff);
+        x = (x | (x << 16)) & UINT64_C(0x001f0000ff0000ff);
+        x = (x | (x << 8)) & UINT64_C(0x100f00f00f00f00f);
+        x = (x | (x << 4)) & UINT64_C(0x10c30c30c30c30c3);
+        x = (x | (x << 2)) & UINT64_C(0x1249249249249249);
+        code[d] = x;
+    }
+    return code[0] | (code[1] << 1) | (code[2] << 2);
+}
+
+// Stable order of the codes in increasing value: "order" receives the positions of the codes, sorted. Uses a parallel
+// least significant digit radix sort which skips the digits that no code uses
+void sortCodes(const std::vector<uint64_t>& codes, std::vector<int>* order);
+
+// Rearrange items so that the new item i is the old item order[i]
+template <class T>
+void applyOrder(const std::vector<int>& order, std::vector<T>* items)
+{
+    if (order.empty()) {
+        (*items).clear();
+        return;
+    }
+
+    std::vector<T> sorted(order.size(), (*items)[0]);
+#pragma omp parallel for
+    for (int i = 0; i < order.size(); i++) {
+        sorted[i] = (*items)[order[i]];
+    }
+    (*items).swap(sorted);
+}
+
+// Sort particles by the Morton code of the grid cell containing them, so that particles that are scattered one after
+// another touch the same grid nodes
+void mortonSortParticles(std::vector<DamageParticle>* particles, double dx);
+
+#endif
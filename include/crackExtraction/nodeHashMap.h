@@ -0,0 +1,139 @@
+#ifndef NODEHASHMAP_H
+
+#define NODEHASHMAP_H
+
+#include "crackExtraction/assertion.h"
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+
+// Flat open addressing hash table which maps grid nodes (i, j, k) to ints, e.g. the position of a node in a node
+// vector. Keys are the three coordinates packed into 64 bits (21 bits each), slots are probed linearly and the table
+// is kept at most half full, so a lookup usually touches a single cache line. The packed key is the identity of a node
+// throughout the extraction; preprocessing makes sure the domain fits into its coordinate range.
+class NodeHashMap {
+public:
+    NodeHashMap() { clear(); }
+
+    // each coordinate of a key must lie in [-coordinateLimit, coordinateLimit)
+    static const int coordinateLimit = 1 << 20;
+
+    // Pack a node's coordinates into a key. Coordinates out of range would share keys with other nodes; the domain is
+    // checked once against coordinateLimit when the particles are preprocessed, so only debug builds check every key
+    static uint64_t key(int i, int j, int k)
+    {
+#ifndef NDEBUG
+        ASSERT(i >= -coordinateLimit && i < coordinateLimit && j >= -coordinateLimit && j < coordinateLimit && k >= -coordinateLimit && k < coordinateLimit);
+#endif
+        const int64_t bias = coordinateLimit;
+        return (uint64_t(i + bias) & coordinateMask) | ((uint64_t(j + bias) & coordinateMask) << 21) | ((uint64_t(k + bias) & coordinateMask) << 42);
+    }
+
+    static uint64_t key(const Eigen::Vector3i& index) { return key(index[0], index[1], index[2]); }
+
+    // value stored for a key, -1 if the key is absent
+    int find(uint64_t k) const
+    {
+        for (size_t s = slot(k);; s = (s + 1) & mask) {
+            if (keys[s] == k) {
+                return values[s];
+            }
+            if (keys[s] == emptyKey) {
+                return -1;
+            }
+        }
+    }
+
+    int find(const Eigen::Vector3i& index) const { return find(key(index)); }
+
+    bool contains(const Eigen::Vector3i& index) const { return find(key(index)) != -1; }
+
+    // store "value" if the key is absent. Returns the value stored for the key, so the caller can tell whether it was
+    // inserted by comparing it with "value"
+    int insert(uint64_t k, int value)
+    {
+        if (2 * (count + 1) > keys.size()) {
+            rehash(2 * keys.size());
+        }
+        size_t s = slot(k);
+        for (; keys[s] != emptyKey; s = (s + 1) & mask) {
+            if (keys[s] == k) {
+                return values[s];
+            }
+        }
+        keys[s] = k;
+        values[s] = value;
+        count += 1;
+        return value;
+    }
+
+    int insert(const Eigen::Vector3i& index, int value) { return insert(key(index), value); }
+
+    // make room for n keys without rehashing
+    void reserve(size_t n)
+    {
+        size_t capacity = keys.size();
+        while (capacity < 2 * n) {
+            capacity *= 2;
+        }
+        if (capacity != keys.size()) {
+            rehash(capacity);
+        }
+    }
+
+    void clear()
+    {
+        keys.assign(size_t(minCapacity), uint64_t(emptyKey));
+        values.assign(size_t(minCapacity), -1);
+        mask = minCapacity - 1;
+        shift = 64 - minCapacityBits;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+private:
+    static const uint64_t coordinateMask = (uint64_t(1) << 21) - 1;
+    static const uint64_t emptyKey = ~uint64_t(0); // packed keys never use the top bit
+    static const int minCapacityBits = 6;
+    static const size_t minCapacity = size_t(1) << minCapacityBits;
+
+    // Fibonacci hashing spreads neighbouring nodes over the table
+    size_t slot(uint64_t k) const { return size_t((k * UINT64_C(0x9E3779B97F4A7C15)) >> shift); }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<uint64_t> oldKeys;
+        std::vector<int> oldValues;
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+
+        keys.assign(capacity, uint64_t(emptyKey));
+        values.assign(capacity, -1);
+        mask = capacity - 1;
+        shift = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            shift -= 1;
+        }
+
+        for (size_t s = 0; s < oldKeys.size(); s++) {
+            if (oldKeys[s] != emptyKey) {
+                size_t t = slot(oldKeys[s]);
+                while (keys[t] != emptyKey) {
+                    t = (t + 1) & mask;
+                }
+                keys[t] = oldKeys[s];
+                values[t] = oldValues[s];
+            }
+        }
+    }
+
+    std::vector<uint64_t> keys;
+    std::vector<int> values;
+    size_t mask = 0;
+    int shift = 64;
+    size_t count = 0;
+};
+
+#endif
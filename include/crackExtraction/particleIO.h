@@ -0,0 +1,93 @@
+#ifndef PARTICLEIO_H
+
+#define PARTICLEIO_H
+
+#include "crackExtraction/particles.h"
+
+#include <Eigen/Core>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. On POSIX systems the file is memory mapped, elsewhere it is read in one go.
+class mappedFile {
+public:
+    mappedFile(const std::string& path);
+    ~mappedFile();
+
+    bool valid() const { return isValid; }
+    const char* data() const { return begin; }
+    size_t size() const { return length; }
+
+private:
+    mappedFile(const mappedFile&);
+    mappedFile& operator=(const mappedFile&);
+
+    const char* begin = nullptr;
+    size_t length = 0;
+    bool isValid = false;
+    bool isMapped = false;
+    std::vector<char> storage; // file content if the file could not be mapped
+};
+
+// number of equally sized bins of the damage histogram over [0, 1]
+const int damageHistogramBins = 20;
+
+// histogram bin of a damage value, values outside [0, 1] are counted in the first or last bin
+inline int damageHistogramBin(double damage)
+{
+    int bin = (int)(damage * damageHistogramBins);
+    return bin < 0 ? 0 : (bin >= damageHistogramBins ? damageHistogramBins - 1 : bin);
+}
+
+// Particles stored as structure of arrays, together with their bounding box
+struct ParticleBuffer {
+    std::vector<double> x, y, z; // each particle's position
+    std::vector<double> damage; // each particle's scalar damage value
+    Eigen::Vector3d minCoordinate = { 0, 0, 0 }; // the minimum coordinate of all particles
+    Eigen::Vector3d maxCoordinate = { 0, 0, 0 }; // the maximum coordinate of all particles
+    double dx = 0; // medial surface resolution suggested by the producer of the file, 0 if unknown
+    std::vector<size_t> damageHistogram; // number of particles in each damage bin
+
+    size_t size() const { return x.size(); }
+};
+
+// Particles classified by damage while they are read. Only the positions are kept; the damage value is replaced by 1 for
+// particles whose damage reaches the damage threshold and by 0 for all others.
+struct particleSets {
+    std::vector<DamageParticle> all; // all particles
+    size_t numFullyDamaged = 0; // number of particles whose damage reaches the damage threshold
+    Eigen::Vector3d minCoordinate = { 0, 0, 0 }; // the minimum coordinate of all particles
+    Eigen::Vector3d maxCoordinate = { 0, 0, 0 }; // the maximum coordinate of all particles
+    double dx = 0; // medial surface resolution suggested by the producer of the file, 0 if unknown
+    std::vector<size_t> damageHistogram; // number of particles in each damage bin
+};
+
+// Header of the binary particle frame format. It is followed by the x, y, z and damage arrays, each holding
+// "count" values in the precision given by "precision". All values are stored in native (little-endian) byte order.
+struct particleFileHeader {
+    char magic[8]; // "CRKPART" followed by a zero byte
+    uint32_t version; // format version, currently 1
+    uint32_t precision; // 0: double, 1: float
+    uint64_t count; // number of particles
+    double minCoordinate[3]; // the minimum coordinate of all particles
+    double maxCoordinate[3]; // the maximum coordinate of all particles
+    double dx; // medial surface resolution suggested by the producer of the file, 0 if unknown
+};
+
+// Parse a floating point number starting at "p" and advance "p" past it. Behaves like atof on malformed input.
+double scanDouble(const char*& p, const char* end);
+
+// Read a particle file into a structure of arrays buffer. Binary frames are detected by their header and read in bulk,
+// otherwise the file is parsed as four-column text (x, y, z, damage) and its bounding box is computed while parsing
+bool loadParticles(std::string path, ParticleBuffer* particles);
+
+// Read a particle file (text or binary frame) and classify each particle against the damage threshold while it is
+// read, so that the particles are only stored in the two sets used by the extraction
+bool ingestParticles(std::string path, double damageThreshold, particleSets* sets);
+
+// Write particles in the binary frame format, optionally in single precision
+bool saveParticlesBinary(std::string path, const ParticleBuffer& particles, bool singlePrecision);
+
+#endif
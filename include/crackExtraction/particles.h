@@ -31,4 +31,23 @@ struct Particle {
     }
 };
 
+// Compact particle used by the crack extraction. Only the position, the damage and the base index of the particle's
+// grid stencil are stored; the weights are cheap to evaluate again whenever they are needed. "real" is double, or float
+// for the single precision extraction.
+template <class real>
+struct DamageParticleT {
+    Eigen::Matrix<real, 3, 1> pos = { 0, 0, 0 }; // particle's position
+    real Dp = 0; // particle's scalar damage value
+    Eigen::Vector3i ppIndex = { 0, 0, 0 }; // particle base index
+
+    DamageParticleT(Eigen::Matrix<real, 3, 1> ipos, real iDp)
+        : pos(ipos)
+        , Dp(iDp)
+    {
+    }
+};
+
+typedef DamageParticleT<double> DamageParticle;
+typedef DamageParticleT<float> DamageParticleF;
+
 #endif
@@ -57,16 +57,14 @@
 #define STALE_INT_PARAM (-1)
 
 // asertion macros
-#define ASSERT_(Expr, Msg, ...)                                      \
-    if (!(Expr)) {                                                   \
-        std::printf("Assert failed:\t\n");                           \
-        std::printf("Expected:\t%s\n", #Expr);                       \
-        std::printf("Source:\t\t%s, line %d\n", __FILE__, __LINE__); \
-        std::printf(Msg, ##__VA_ARGS__);                             \
-        std::abort();                                                \
-    }
+#include "crackExtraction/assertion.h"
 
-#define ASSERT(Expr) ASSERT_(Expr, " \b")
+// interpolation kernel between particles and grid nodes
+enum interpolationKernel {
+    linearInterpolation, // linear B-spline, a fast preview
+    quadraticInterpolation, // quadratic B-spline
+    cubicInterpolation // cubic B-spline
+};
 
 struct parametersSim {
 
@@ -84,15 +82,21 @@ struct parametersSim {
     std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d>> appliedForce;
 
     double damageThreshold = 0.97; // after this threshold,
-};
 
-static int calculateID(int x, int y, int z, Eigen::Vector3d len, double dx) // coordinate of x and y, length in three dimensions of the cube, grid space
-{
-    Eigen::Vector3i length = (len / dx).cast<int>() + Eigen::Vector3i::Constant(1);
-    int ID = z * (length(0) * length(1)) + y * length(0) + x;
-    return ID;
+    // scatter particles to the grid in a fixed order, so results are bitwise reproducible for any number of threads
+    bool deterministic = false;
+
+    // sort the particles in Morton order before they are scattered to the grid
+    bool mortonSort = false;
+
+    // interpolation kernel of the damage field
+    interpolationKernel kernel = quadraticInterpolation;
+
+    // store the damage grid, the weights and the Voronoi geometry in single precision
+    bool singlePrecision = false;
 };
 
+
 // return two vectors which define the crack surface
 struct crackSurface {
     std::vector<Eigen::Vector3d> vertices; // vertices of the crack surface
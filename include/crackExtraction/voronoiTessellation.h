@@ -0,0 +1,203 @@
+#ifndef VORONOITESSELLATION_H
+
+#define VORONOITESSELLATION_H
+
+#include <Eigen/Core>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Voronoi cells stored in flat arrays with offsets per cell (compressed sparse rows). Cell c owns the vertices
+// [vertexOffset[c], vertexOffset[c + 1]) and the faces [faceOffset[c], faceOffset[c + 1]). Face f has the neighbour
+// neighbourIds[f] across it, the outward normal normals[f] and the vertices faceVertexIndices[faceVertexOffset[f]] to
+// faceVertexIndices[faceVertexOffset[f + 1] - 1], which are numbered inside the cell. Faces are also numbered over all
+// cells, so per-face data can be kept in a plain array indexed by firstFace(c) + k. The vertices and normals are stored
+// as "real", double or float for the single precision extraction. A tessellation may also hold the topology of the
+// cells only, their neighbours; then the faces have neither vertices nor normals.
+template <class real>
+class VoronoiTessellation {
+public:
+    typedef Eigen::Matrix<real, 3, 1> vector3;
+
+    // consecutive ints of the tessellation, e.g. the neighbours of a cell or the vertices of a face
+    struct indexRange {
+        const int* first;
+        const int* last;
+
+        const int* begin() const { return first; }
+        const int* end() const { return last; }
+        int size() const { return (int)(last - first); }
+        int operator[](int k) const { return first[k]; }
+    };
+
+    VoronoiTessellation() { clear(); }
+
+    void clear()
+    {
+        positions.clear();
+        vertices.clear();
+        neighbourIds.clear();
+        normals.clear();
+        faceVertexIndices.clear();
+        vertexOffset.assign(1, 0);
+        faceOffset.assign(1, 0);
+        faceVertexOffset.assign(1, 0);
+    }
+
+    // Append a cell with its seed at "pos". Its vertices and faces are added by addVertex() and addFace() until the next
+    // cell is begun
+    void beginCell(const Eigen::Vector3d& pos)
+    {
+        positions.push_back(pos);
+        vertexOffset.push_back(vertexOffset.back());
+        faceOffset.push_back(faceOffset.back());
+    }
+
+    void addVertex(const vector3& vertex)
+    {
+        vertices.push_back(vertex);
+        vertexOffset.back() += 1;
+    }
+
+    // add a face with "n" vertices, given by their number inside the cell
+    void addFace(int neighbour, const vector3& normal, const int* faceVertices, int n)
+    {
+        neighbourIds.push_back(neighbour);
+        normals.push_back(normal);
+        faceVertexIndices.insert(faceVertexIndices.end(), faceVertices, faceVertices + n);
+        faceVertexOffset.push_back((int)faceVertexIndices.size());
+        faceOffset.back() += 1;
+    }
+
+    // add a face of a cell whose geometry is not stored, see hasGeometry()
+    void addFace(int neighbour)
+    {
+        neighbourIds.push_back(neighbour);
+        faceVertexOffset.push_back((int)faceVertexIndices.size());
+        faceOffset.back() += 1;
+    }
+
+    // whether the faces have their vertices and normals. A tessellation stores the geometry of all of its faces or of
+    // none of them
+    bool hasGeometry() const { return normals.size() == neighbourIds.size(); }
+
+    int numCells() const { return (int)positions.size(); }
+    int numFaces() const { return faceOffset.back(); } // faces of all cells
+
+    const Eigen::Vector3d& pos(int cell) const { return positions[cell]; }
+    int numVertices(int cell) const { return vertexOffset[cell + 1] - vertexOffset[cell]; }
+    const vector3& vertex(int cell, int v) const { return vertices[vertexOffset[cell] + v]; }
+
+    int numFaces(int cell) const { return faceOffset[cell + 1] - faceOffset[cell]; }
+    int firstFace(int cell) const { return faceOffset[cell]; }
+
+    // neighbours across the faces of a cell, a negative id for a wall of the container
+    indexRange neighbours(int cell) const { return { neighbourIds.data() + faceOffset[cell], neighbourIds.data() + faceOffset[cell + 1] }; }
+    int neighbour(int cell, int k) const { return neighbourIds[faceOffset[cell] + k]; }
+    const vector3& normal(int cell, int k) const { return normals[faceOffset[cell] + k]; }
+
+    // vertices of face k of a cell, in the order voro++ gives them
+    indexRange faceVertices(int cell, int k) const
+    {
+        int f = faceOffset[cell] + k;
+        return { faceVertexIndices.data() + faceVertexOffset[f], faceVertexIndices.data() + faceVertexOffset[f + 1] };
+    }
+
+    // Replace the cells by cells of other tessellations: cell m becomes cell source[m].second of
+    // parts[source[m].first], or an empty cell at the origin if source[m].first is -1. The parts either all store their
+    // geometry or none of them does. The cells are copied in parallel
+    void gather(const std::vector<VoronoiTessellation>& parts, const std::vector<std::pair<int, int>>& source)
+    {
+        int n = (int)source.size();
+        bool geometry = true;
+        for (int p = 0; p < (int)parts.size(); p++) {
+            geometry = geometry && parts[p].hasGeometry();
+        }
+        clear();
+        positions.assign(n, Eigen::Vector3d::Zero());
+        vertexOffset.resize(n + 1);
+        faceOffset.resize(n + 1);
+        for (int m = 0; m < n; m++) {
+            int p = source[m].first, c = source[m].second;
+            vertexOffset[m + 1] = vertexOffset[m] + (p == -1 ? 0 : parts[p].numVertices(c));
+            faceOffset[m + 1] = faceOffset[m] + (p == -1 ? 0 : parts[p].numFaces(c));
+        }
+        faceVertexOffset.resize(faceOffset[n] + 1);
+        for (int m = 0; m < n; m++) {
+            int p = source[m].first, c = source[m].second;
+            for (int k = 0; k < numFaces(m); k++) {
+                faceVertexOffset[faceOffset[m] + k + 1] = faceVertexOffset[faceOffset[m] + k] + parts[p].faceVertices(c, k).size();
+            }
+        }
+        vertices.resize(vertexOffset[n]);
+        neighbourIds.resize(faceOffset[n]);
+        normals.resize(geometry ? faceOffset[n] : 0);
+        faceVertexIndices.resize(faceVertexOffset[faceOffset[n]]);
+
+#pragma omp parallel for schedule(static, 256)
+        for (int m = 0; m < n; m++) {
+            int p = source[m].first, c = source[m].second;
+            if (p == -1) {
+                continue;
+            }
+
+            const VoronoiTessellation& part = parts[p];
+            positions[m] = part.positions[c];
+            std::copy(part.vertices.begin() + part.vertexOffset[c], part.vertices.begin() + part.vertexOffset[c + 1], vertices.begin() + vertexOffset[m]);
+            std::copy(part.neighbourIds.begin() + part.faceOffset[c], part.neighbourIds.begin() + part.faceOffset[c + 1], neighbourIds.begin() + faceOffset[m]);
+            if (geometry) {
+                std::copy(part.normals.begin() + part.faceOffset[c], part.normals.begin() + part.faceOffset[c + 1], normals.begin() + faceOffset[m]);
+            }
+            int firstIndex = part.faceVertexOffset[part.faceOffset[c]], lastIndex = part.faceVertexOffset[part.faceOffset[c + 1]];
+            std::copy(part.faceVertexIndices.begin() + firstIndex, part.faceVertexIndices.begin() + lastIndex, faceVertexIndices.begin() + faceVertexOffset[faceOffset[m]]);
+        }
+    }
+
+private:
+    std::vector<Eigen::Vector3d> positions; // seed of each cell
+    std::vector<vector3> vertices;
+    std::vector<int> neighbourIds;
+    std::vector<vector3> normals;
+    std::vector<int> faceVertexIndices;
+    std::vector<int> vertexOffset; // first vertex of each cell, the last entry is the number of vertices
+    std::vector<int> faceOffset; // first face of each cell, the last entry is the number of faces
+    std::vector<int> faceVertexOffset; // first entry of each face in faceVertexIndices, the last entry is its size
+};
+
+// Lists of neighbours per cell which grow while the faces between the cells are classified. The entries of all lists
+// share one array and are linked per cell, so a list needs no allocation of its own and keeps the order its entries
+// were added in. A list is walked with
+//     for (int e = lists.first(cell); e != -1; e = lists.next(e)) ... lists.neighbour(e) ...
+class NeighbourLists {
+public:
+    NeighbourLists(int numCells)
+        : head(numCells, -1)
+        , tail(numCells, -1)
+    {
+    }
+
+    void add(int cell, int neighbour)
+    {
+        int e = (int)neighbourIds.size();
+        neighbourIds.push_back(neighbour);
+        nextEntry.push_back(-1);
+        if (tail[cell] == -1) {
+            head[cell] = e;
+        } else {
+            nextEntry[tail[cell]] = e;
+        }
+        tail[cell] = e;
+    }
+
+    int first(int cell) const { return head[cell]; }
+    int next(int e) const { return nextEntry[e]; }
+    int neighbour(int e) const { return neighbourIds[e]; }
+
+private:
+    std::vector<int> head; // first entry of each cell, -1 for an empty list
+    std::vector<int> tail; // last entry of each cell
+    std::vector<int> neighbourIds;
+    std::vector<int> nextEntry; // the entry following each entry in its list, -1 at the end
+};
+
+#endif
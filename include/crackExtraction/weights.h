@@ -2,20 +2,23 @@
 
 #define WEIGHTS_H
 
+#include <algorithm>
 #include <math.h>
 #include <vector>
 
 #include <Eigen/Core>
 #include <Eigen/Eigenvalues>
 
-// Struct of weights
+// Struct of weights. All members have a fixed size, so evaluating the weights never allocates
 struct weightAndDreri {
     Eigen::Vector3i ppIndex = { 0, 0, 0 }; // each particle's weight
     Eigen::Vector3d space = { 0, 0, 0 }; // each particle's weight derivative
-    Eigen::MatrixXd weight;
-    Eigen::MatrixXd deltaWeight;
+    Eigen::Matrix3d weight = Eigen::Matrix3d::Zero(); // weight(d, i): weight of the i-th stencil node along axis d
+    Eigen::Matrix3d deltaWeight = Eigen::Matrix3d::Zero();
 
-    weightAndDreri(Eigen::Vector3i ippIndex, Eigen::Vector3d ispace, Eigen::MatrixXd iweight, Eigen::MatrixXd ideltaWeight)
+    weightAndDreri() { }
+
+    weightAndDreri(Eigen::Vector3i ippIndex, Eigen::Vector3d ispace, const Eigen::Matrix3d& iweight, const Eigen::Matrix3d& ideltaWeight)
         : ppIndex(ippIndex)
         , space(ispace)
         , weight(iweight)
@@ -26,4 +29,131 @@ struct weightAndDreri {
 
 struct weightAndDreri calWeight(double, Eigen::Vector3d);
 
+// calculate the weights of n points at once
+void calWeights(double, const Eigen::Vector3d*, int, struct weightAndDreri*);
+
+// Weights of a batch of points stored as structure of arrays, so that several points are evaluated per instruction.
+// "real" is double, or float for the single precision extraction which fits twice as many points in a vector
+template <class real>
+struct weightBatchT {
+    static const int capacity = 64; // maximum number of points in a batch
+    int ppIndex[3][capacity]; // ppIndex[d][p]: base index of point p along axis d
+    real space[3][capacity];
+    real weight[3][3][capacity]; // weight[d][i][p]: weight of the i-th stencil node of point p along axis d
+    real deltaWeight[3][3][capacity];
+};
+
+template <class real>
+const int weightBatchT<real>::capacity;
+
+typedef weightBatchT<double> weightBatch;
+typedef weightBatchT<float> weightBatchF;
+
+// calculate the weights of n <= weightBatch::capacity points given by their coordinates. The kernel is chosen at run
+// time: AVX-512 or AVX2 if the CPU supports it, scalar otherwise. All kernels give bitwise identical results
+void calWeightBatch(double dx, const double* x, const double* y, const double* z, int n, weightBatch* res);
+void calWeightBatch(float dx, const float* x, const float* y, const float* z, int n, weightBatchF* res);
+
+// name of the weight kernel selected for this CPU
+const char* weightKernelName();
+
+// Interpolation kernels used as compile-time policies. "width" is the number of stencil nodes along each axis, so that
+// loops over a stencil unroll completely. axis() gives the first stencil node of a coordinate and the weights and
+// weight derivatives of the stencil nodes along that axis, in double or float. The kernels that support the APIC form
+// of the damage gradient give its inertia D = inertia(dx), so that the gradient is the sum of weight * D^-1 * (x - x_i).
+// A point counts as fully damaged once fullyDamagedNodes of its stencil nodes are, the share 8 / 27 of the quadratic
+// stencil rounded up, so that the test means the same for every kernel.
+
+// linear B-spline, 2 nodes per axis. Meant as a fast preview. It has no APIC form, its gradients use the weight
+// derivatives
+struct linearKernel {
+    static constexpr int width = 2;
+    static constexpr int fullyDamagedNodes = 3; // of 8
+
+    template <class real>
+    static void axis(real dx, real coord, int* base, real* weight, real* deltaWeight)
+    {
+        real scaled = coord / dx;
+        *base = (int)scaled;
+        real s = scaled - (real)*base;
+
+        weight[0] = real(1.0) - s;
+        weight[1] = s;
+
+        deltaWeight[0] = real(-1.0) / dx;
+        deltaWeight[1] = real(1.0) / dx;
+    }
+};
+
+// quadratic B-spline, 3 nodes per axis. axis() is compiled together with calWeightBatch, so the results are identical
+struct quadraticKernel {
+    static constexpr int width = 3;
+    static constexpr int fullyDamagedNodes = 8; // of 27
+
+    template <class real>
+    static void axis(real dx, real coord, int* base, real* weight, real* deltaWeight);
+
+    template <class real>
+    static real inertia(real dx) { return dx * dx / 4; }
+};
+
+// cubic B-spline, 4 nodes per axis
+struct cubicKernel {
+    static constexpr int width = 4;
+    static constexpr int fullyDamagedNodes = 19; // of 64
+
+    template <class real>
+    static void axis(real dx, real coord, int* base, real* weight, real* deltaWeight)
+    {
+        real scaled = coord / dx;
+        *base = (int)scaled - 1;
+        real t = scaled - (real)(*base + 1);
+
+        weight[0] = (real(1.0) - t) * (real(1.0) - t) * (real(1.0) - t) / real(6.0);
+        weight[1] = (real(3.0) * t * t * t - real(6.0) * t * t + real(4.0)) / real(6.0);
+        weight[2] = (real(-3.0) * t * t * t + real(3.0) * t * t + real(3.0) * t + real(1.0)) / real(6.0);
+        weight[3] = t * t * t / real(6.0);
+
+        deltaWeight[0] = real(-0.5) * (real(1.0) - t) * (real(1.0) - t) / dx;
+        deltaWeight[1] = (real(1.5) * t * t - real(2.0) * t) / dx;
+        deltaWeight[2] = (real(-1.5) * t * t + t + real(0.5)) / dx;
+        deltaWeight[3] = real(0.5) * t * t / dx;
+    }
+
+    template <class real>
+    static real inertia(real dx) { return dx * dx / 3; }
+};
+
+// Weights of a point for a kernel. ppIndex is the first stencil node, weight[d][i] the weight of the i-th stencil node
+// along axis d
+template <class kernel, class real = double>
+struct kernelWeights {
+    Eigen::Vector3i ppIndex = { 0, 0, 0 };
+    real weight[3][kernel::width];
+    real deltaWeight[3][kernel::width];
+};
+
+template <class kernel, class real>
+kernelWeights<kernel, real> calKernelWeights(real dx, const Eigen::Matrix<real, 3, 1>& pos)
+{
+    kernelWeights<kernel, real> res;
+    for (int d = 0; d < 3; d++) {
+        kernel::axis(dx, pos[d], &res.ppIndex[d], res.weight[d], res.deltaWeight[d]);
+    }
+    return res;
+}
+
+// Weights of a point located at a node, along one axis. The first stencil node lies "offset" nodes from the point. The
+// weight derivatives are those of a unit node spacing and only given if "deltaWeight" is not null
+template <class kernel, class real>
+void calNodeKernelWeights(int* offset, real* weight, real* deltaWeight = nullptr)
+{
+    real unitDeltaWeight[kernel::width];
+    kernel::axis(real(1.0), real(2.0), offset, weight, unitDeltaWeight);
+    *offset -= 2;
+    if (deltaWeight != nullptr) {
+        std::copy(unitDeltaWeight, unitDeltaWeight + kernel::width, deltaWeight);
+    }
+}
+
 #endif
@@ -0,0 +1,48 @@
+#include "crackExtraction/particleIO.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Convert a four-column particle text file (x, y, z, damage) into the binary particle frame format
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <particles.txt> <particles.bin> [--float] [--dx <medial surface resolution>]\n", argv[0]);
+        std::exit(1);
+    }
+
+    std::string inputPath = argv[1];
+    std::string outputPath = argv[2];
+    bool singlePrecision = false;
+    double dx = 0;
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--float") {
+            singlePrecision = true;
+        } else if (option == "--dx" && i + 1 < argc) {
+            dx = std::stod(argv[++i]);
+        } else {
+            fprintf(stderr, "error: unknown option %s\n", option.c_str());
+            std::exit(1);
+        }
+    }
+
+    ParticleBuffer particles;
+    if (!loadParticles(inputPath, &particles)) {
+        fprintf(stderr, "error: failed to read particles from %s\n", inputPath.c_str());
+        std::exit(1);
+    }
+    if (dx != 0) {
+        particles.dx = dx;
+    }
+
+    if (!saveParticlesBinary(outputPath, particles, singlePrecision)) {
+        fprintf(stderr, "error: failed to write %s\n", outputPath.c_str());
+        std::exit(1);
+    }
+
+    printf("converted %d particles to %s\n", (int)particles.size(), outputPath.c_str());
+
+    return 0;
+}
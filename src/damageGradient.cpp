@@ -1,145 +1,455 @@
 ﻿#include "crackExtraction/damageGradient.h"
 
-// calculate the damage gradient of all particles and grid nodes.
-void calDamageGradient(std::vector<Particle>* particles, parametersSim param, double dx, std::map<int, int>* gridMap, std::vector<Grid>* nodesVec)
+#include <algorithm>
+#include <omp.h>
+
+// Evaluate the kernel weights of particles and call visit(f, weights) for each of them. The particles are indices[begin]
+// to indices[end - 1], or begin to end - 1 if "indices" is null
+template <class kernel, class real>
+struct particleWeightLoop {
+    template <class particleVisitor>
+    static void run(const std::vector<DamageParticleT<real>>& particles, real dx, const int* indices, int begin, int end, particleVisitor& visit)
+    {
+        for (int t = begin; t < end; t++) {
+            int f = (indices == nullptr) ? t : indices[t];
+            visit(f, calKernelWeights<kernel>(dx, particles[f].pos));
+        }
+    }
+};
+
+// the quadratic kernel is evaluated in batches with the SIMD weight kernel
+template <class real>
+struct particleWeightLoop<quadraticKernel, real> {
+    template <class particleVisitor>
+    static void run(const std::vector<DamageParticleT<real>>& particles, real dx, const int* indices, int begin, int end, particleVisitor& visit)
+    {
+        const int batchSize = weightBatch::capacity;
+        real batchX[batchSize], batchY[batchSize], batchZ[batchSize];
+        int batchParticle[batchSize];
+        weightBatchT<real> batch;
+        kernelWeights<quadraticKernel, real> weights;
+
+        for (int start = begin; start < end; start += batchSize) {
+            int n = std::min(batchSize, end - start);
+            for (int b = 0; b < n; b++) {
+                batchParticle[b] = (indices == nullptr) ? start + b : indices[start + b];
+                batchX[b] = particles[batchParticle[b]].pos[0];
+                batchY[b] = particles[batchParticle[b]].pos[1];
+                batchZ[b] = particles[batchParticle[b]].pos[2];
+            }
+            calWeightBatch(dx, batchX, batchY, batchZ, n, &batch);
+
+            for (int b = 0; b < n; b++) {
+                for (int d = 0; d < 3; d++) {
+                    weights.ppIndex[d] = batch.ppIndex[d][b];
+                    for (int i = 0; i < 3; i++) {
+                        weights.weight[d][i] = batch.weight[d][i][b];
+                        weights.deltaWeight[d][i] = batch.deltaWeight[d][i][b];
+                    }
+                }
+                visit(batchParticle[b], weights);
+            }
+        }
+    }
+};
+
+template <class kernel, class real, class particleVisitor>
+static void forEachParticleWeight(const std::vector<DamageParticleT<real>>& particles, real dx, const int* indices, int begin, int end, particleVisitor visit)
 {
-    for (int f = 0; f < particles->size(); f++) {
-        struct weightAndDreri WD = calWeight(dx, (*particles)[f].pos);
+    particleWeightLoop<kernel, real>::run(particles, dx, indices, begin, end, visit);
+}
 
-        (*particles)[f].ppIndex = WD.ppIndex;
-        (*particles)[f].weight = WD.weight;
-        (*particles)[f].deltaWeight = WD.deltaWeight;
-    };
+// The particles scattered by one thread: a range of consecutive particles and the nodes they touch
+template <class real>
+struct scatterChunk {
+    int begin = 0, end = 0; // the particles [begin, end)
+    NodeHashMap localIds; // node to its position in "nodes"
+    std::vector<Eigen::Vector3i> nodes; // touched nodes in the order they are first touched
+    std::vector<int> nodeIds; // node id of each touched node in the grid
+    std::vector<real> Di, sw; // partial sums of each touched node
+};
 
-    int count = -1; // count the number of active grid node
-    // number of grid nodes per edge
+// Scatter the particles' damage to the grid nodes with all threads. The nodes touched by each chunk of particles are
+// collected in parallel and then activated chunk by chunk, which activates them in the same order as a serial scatter.
+// The damage is then either summed into per-chunk partial grids which are added up in chunk order, or, in deterministic
+// mode, scattered brick colour by brick colour so that every node sums its contributions in an order that does not
+// depend on the number of threads.
+template <class kernel, class real>
+static void scatterDamage(std::vector<DamageParticleT<real>>* particles, parametersSim param, real dx, DamageGridT<real>* grid)
+{
+    const int w = kernel::width;
+    int numParticles = (int)particles->size();
 
-    // calculate node damage value
-    for (int f = 0; f < particles->size(); f++) {
-        (*particles)[f].deltaD = { 0, 0, 0 };
-
-        for (int i = 0; i < 3; i++) {
-            for (int j = 0; j < 3; j++) {
-                for (int k = 0; k < 3; k++) {
-                    int ID = calculateID((*particles)[f].ppIndex[0] + i, (*particles)[f].ppIndex[1] + j, (*particles)[f].ppIndex[2] + k, param.length, dx);
-                    double weight = (*particles)[f].weight(0, i) * (*particles)[f].weight(1, j) * (*particles)[f].weight(2, k);
-
-                    if (weight != 0) {
-                        if ((*gridMap).find(ID) == (*gridMap).end()) {
-                            count += 1;
-                            (*gridMap)[ID] = count;
-                            (*nodesVec).push_back(Grid(0.0));
-
-                            (*nodesVec)[count].posIndex = { (*particles)[f].ppIndex[0] + i, (*particles)[f].ppIndex[1] + j, (*particles)[f].ppIndex[2] + k };
-                            (*nodesVec)[count].Di += (*particles)[f].Dp * weight;
-                            (*nodesVec)[count].sw += weight;
-                        } else {
-                            int eid = (*gridMap)[ID];
-
-                            (*nodesVec)[eid].Di += (*particles)[f].Dp * weight;
-                            (*nodesVec)[eid].sw += weight;
+    // small particle sets are not worth splitting
+    int numChunks = std::max(1, std::min(omp_get_max_threads(), numParticles / 4096));
+    std::vector<scatterChunk<real>> chunks(numChunks);
+
+    // collect the nodes touched by each chunk
+#pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numChunks; c++) {
+        scatterChunk<real>& chunk = chunks[c];
+        chunk.begin = (int)((int64_t)numParticles * c / numChunks);
+        chunk.end = (int)((int64_t)numParticles * (c + 1) / numChunks);
+        forEachParticleWeight<kernel>(*particles, dx, nullptr, chunk.begin, chunk.end, [&](int f, const kernelWeights<kernel, real>& WD) {
+            (*particles)[f].ppIndex = WD.ppIndex;
+            for (int i = 0; i < w; i++) {
+                for (int j = 0; j < w; j++) {
+                    for (int k = 0; k < w; k++) {
+                        real weight = WD.weight[0][i] * WD.weight[1][j] * WD.weight[2][k];
+
+                        if (weight != 0) {
+                            Eigen::Vector3i nodeIndex = { WD.ppIndex[0] + i, WD.ppIndex[1] + j, WD.ppIndex[2] + k };
+                            int local = (int)chunk.nodes.size();
+                            if (chunk.localIds.insert(nodeIndex, local) == local) {
+                                chunk.nodes.push_back(nodeIndex);
+                            }
                         };
                     };
                 };
             };
-        };
-    };
+        });
+    }
 
-    // calculate particle damage gradient
-    for (int f = 0; f < particles->size(); f++) {
-        for (int i = 0; i < 3; i++) {
-            for (int j = 0; j < 3; j++) {
-                for (int k = 0; k < 3; k++) {
-                    int ID = calculateID((*particles)[f].ppIndex[0] + i, (*particles)[f].ppIndex[1] + j, (*particles)[f].ppIndex[2] + k, param.length, dx);
-                    double weight = (*particles)[f].weight(0, i) * (*particles)[f].weight(1, j) * (*particles)[f].weight(2, k);
-
-                    if (weight != 0) {
-                        int eid = (*gridMap)[ID];
-
-                        Eigen::Vector3d posD = (*particles)[f].pos - (*nodesVec)[eid].posIndex.cast<double>() * dx;
-                        (*particles)[f].deltaD += weight / (dx * dx / 4) * (*nodesVec)[eid].Di / (*nodesVec)[eid].sw * posD;
+    // activate the nodes in the order of a serial scatter
+    int numTouched = 0;
+    for (int c = 0; c < numChunks; c++) {
+        numTouched += (int)chunks[c].nodes.size();
+    }
+    (*grid).reserve((*grid).numNodes() + numTouched);
+    for (int c = 0; c < numChunks; c++) {
+        chunks[c].nodeIds.resize(chunks[c].nodes.size());
+        for (int l = 0; l < chunks[c].nodes.size(); l++) {
+            chunks[c].nodeIds[l] = (*grid).activate(chunks[c].nodes[l]);
+        }
+    }
+
+    if (!param.deterministic) {
+        // sum each chunk into its own partial grid
+#pragma omp parallel for schedule(static, 1)
+        for (int c = 0; c < numChunks; c++) {
+            scatterChunk<real>& chunk = chunks[c];
+            chunk.Di.assign(chunk.nodes.size(), 0);
+            chunk.sw.assign(chunk.nodes.size(), 0);
+            forEachParticleWeight<kernel>(*particles, dx, nullptr, chunk.begin, chunk.end, [&](int f, const kernelWeights<kernel, real>& WD) {
+                for (int i = 0; i < w; i++) {
+                    for (int j = 0; j < w; j++) {
+                        for (int k = 0; k < w; k++) {
+                            real weight = WD.weight[0][i] * WD.weight[1][j] * WD.weight[2][k];
+
+                            if (weight != 0) {
+                                int local = chunk.localIds.find(NodeHashMap::key(WD.ppIndex[0] + i, WD.ppIndex[1] + j, WD.ppIndex[2] + k));
+                                chunk.Di[local] += (*particles)[f].Dp * weight;
+                                chunk.sw[local] += weight;
+                            };
+                        };
+                    };
+                };
+            });
+        }
+
+        // add up the partial grids in chunk order. The nodes of one chunk are distinct
+        for (int c = 0; c < numChunks; c++) {
+            const scatterChunk<real>& chunk = chunks[c];
+#pragma omp parallel for
+            for (int l = 0; l < chunk.nodes.size(); l++) {
+                (*grid).Di(chunk.nodeIds[l]) += chunk.Di[l];
+                (*grid).sw(chunk.nodeIds[l]) += chunk.sw[l];
+            }
+        }
+        return;
+    }
+
+    // Deterministic mode. The particles are grouped by the brick of their ppIndex. A particle only touches nodes in its
+    // own brick and the next one along each axis, so bricks of the same colour (parity of the brick coordinates) never
+    // share a node and can be scattered concurrently
+    NodeHashMap brickIds;
+    std::vector<int> particleBrick(numParticles);
+    std::vector<int> brickColour;
+    std::vector<int> brickOffset(1, 0);
+    for (int f = 0; f < numParticles; f++) {
+        const Eigen::Vector3i& ppIndex = (*particles)[f].ppIndex;
+        Eigen::Vector3i brick = { ppIndex[0] >> DamageGridT<real>::brickBits, ppIndex[1] >> DamageGridT<real>::brickBits, ppIndex[2] >> DamageGridT<real>::brickBits };
+        int id = brickIds.insert(brick, (int)brickColour.size());
+        if (id == (int)brickColour.size()) {
+            brickColour.push_back((brick[0] & 1) | ((brick[1] & 1) << 1) | ((brick[2] & 1) << 2));
+            brickOffset.push_back(0);
+        }
+        particleBrick[f] = id;
+        brickOffset[id + 1] += 1;
+    }
+    int numBricks = (int)brickColour.size();
+    for (int n = 0; n < numBricks; n++) {
+        brickOffset[n + 1] += brickOffset[n];
+    }
+    std::vector<int> brickParticles(numParticles); // particles of each brick in increasing order
+    std::vector<int> fill(brickOffset.begin(), brickOffset.end() - 1);
+    for (int f = 0; f < numParticles; f++) {
+        brickParticles[fill[particleBrick[f]]++] = f;
+    }
+
+    for (int colour = 0; colour < 8; colour++) {
+        std::vector<int> colourBricks;
+        for (int n = 0; n < numBricks; n++) {
+            if (brickColour[n] == colour) {
+                colourBricks.push_back(n);
+            }
+        }
+
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int m = 0; m < colourBricks.size(); m++) {
+            int n = colourBricks[m];
+            forEachParticleWeight<kernel>(*particles, dx, brickParticles.data(), brickOffset[n], brickOffset[n + 1], [&](int f, const kernelWeights<kernel, real>& WD) {
+                int stencil[w * w * w];
+                (*grid).template findStencil<w>(WD.ppIndex, stencil);
+                for (int i = 0; i < w; i++) {
+                    for (int j = 0; j < w; j++) {
+                        for (int k = 0; k < w; k++) {
+                            real weight = WD.weight[0][i] * WD.weight[1][j] * WD.weight[2][k];
+
+                            if (weight != 0) {
+                                int eid = stencil[(i * w + j) * w + k];
+                                (*grid).Di(eid) += (*particles)[f].Dp * weight;
+                                (*grid).sw(eid) += weight;
+                            };
+                        };
+                    };
+                };
+            });
+        }
+    }
+}
+
+// Contribution of the stencil node (i, j, k) to a damage gradient, where the node holds the damage Di with the weight
+// sum sw and posD is the point minus the node. Kernels with an APIC form use weight * D^-1 * posD; the linear kernel
+// uses the weight derivative, negated to point the same way, towards decreasing damage
+template <class kernel>
+struct gradientTerm {
+    template <class real>
+    static Eigen::Matrix<real, 3, 1> eval(const real (&weight)[3][kernel::width], const real (&)[3][kernel::width], int i, int j, int k, real dx, const Eigen::Matrix<real, 3, 1>& posD, real Di, real sw)
+    {
+        real w = weight[0][i] * weight[1][j] * weight[2][k];
+        return w / kernel::inertia(dx) * Di / sw * posD;
+    }
+};
+
+template <>
+struct gradientTerm<linearKernel> {
+    template <class real>
+    static Eigen::Matrix<real, 3, 1> eval(const real (&weight)[3][2], const real (&deltaWeight)[3][2], int i, int j, int k, real, const Eigen::Matrix<real, 3, 1>&, real Di, real sw)
+    {
+        Eigen::Matrix<real, 3, 1> gradWeight(deltaWeight[0][i] * weight[1][j] * weight[2][k], weight[0][i] * deltaWeight[1][j] * weight[2][k], weight[0][i] * weight[1][j] * deltaWeight[2][k]);
+        return -(Di / sw) * gradWeight;
+    }
+};
+
+// calculate the damage gradient of all particles from the grid before the node damage values are normalised
+template <class kernel, class real>
+static void calParticleDamageGradient(std::vector<DamageParticleT<real>>* particles, real dx, DamageGridT<real>* grid, std::vector<Eigen::Matrix<real, 3, 1>>* deltaD)
+{
+    typedef Eigen::Matrix<real, 3, 1> vector3;
+    const int w = kernel::width;
+    const int batchSize = weightBatch::capacity;
+    int numParticles = (int)particles->size();
+    (*deltaD).assign(numParticles, vector3::Zero());
+#pragma omp parallel for schedule(static)
+    for (int start = 0; start < numParticles; start += batchSize) {
+        int end = std::min(start + batchSize, numParticles);
+        forEachParticleWeight<kernel>(*particles, dx, nullptr, start, end, [&](int f, const kernelWeights<kernel, real>& WD) {
+            int stencil[w * w * w];
+            (*grid).template findStencil<w>(WD.ppIndex, stencil);
+            for (int i = 0; i < w; i++) {
+                for (int j = 0; j < w; j++) {
+                    for (int k = 0; k < w; k++) {
+                        int eid = stencil[(i * w + j) * w + k];
+
+                        if (eid != -1) {
+                            vector3 posD = (*particles)[f].pos - (*grid).posIndex(eid).template cast<real>() * dx;
+                            (*deltaD)[f] += gradientTerm<kernel>::eval(WD.weight, WD.deltaWeight, i, j, k, dx, posD, (*grid).Di(eid), (*grid).sw(eid));
+                        };
                     };
                 };
             };
-        };
-    };
+        });
+    }
+}
+
+template <class kernel, class real>
+static void calDamageGradientKernel(std::vector<DamageParticleT<real>>* particles, parametersSim param, real dx, DamageGridT<real>* grid, std::vector<Eigen::Matrix<real, 3, 1>>* deltaD)
+{
+    // calculate node damage value
+    (*grid).clearGradient();
+    scatterDamage<kernel>(particles, param, dx, grid);
+
+    // calculate particle damage gradient
+    if (deltaD != nullptr) {
+        calParticleDamageGradient<kernel>(particles, dx, grid, deltaD);
+    }
 
-    // calculate grid node's damage gradient. This gives the exact value.
-    for (int g = 0; g < (*nodesVec).size(); g++) {
-        Eigen::Vector3d weightVec = { 0.125, 0.75, 0.125 };
-        Eigen::Vector3d posVec = { dx, 0, -dx };
-
-        for (int i = 0; i < 3; i++) {
-            for (int j = 0; j < 3; j++) {
-                for (int k = 0; k < 3; k++) {
-                    int ID = calculateID((int)(*nodesVec)[g].posIndex[0] + i - 1, (int)(*nodesVec)[g].posIndex[1] + j - 1, (int)(*nodesVec)[g].posIndex[2] + k - 1, param.length, dx);
-                    double weight = weightVec[i] * weightVec[j] * weightVec[k];
-
-                    if ((*gridMap).find(ID) != (*gridMap).end()) {
-                        int eid = (*gridMap)[ID];
-                        Eigen::Vector3d posD = { posVec[i], posVec[j], posVec[k] };
-                        (*nodesVec)[g].deltaDi += weight / (dx * dx / 4) * (*nodesVec)[eid].Di / (*nodesVec)[eid].sw * posD;
+    // normalise the node damage values
+    int numNodes = (*grid).numNodes();
+#pragma omp parallel for
+    for (int g = 0; g < numNodes; g++) {
+        (*grid).Di(g) = (*grid).Di(g) / (*grid).sw(g);
+    }
+}
+
+// calculate the damage value of all grid nodes, and the damage gradient of all particles if "deltaD" is given
+template <class real>
+void calDamageGradient(std::vector<DamageParticleT<real>>* particles, parametersSim param, double dx, DamageGridT<real>* grid, std::vector<Eigen::Matrix<real, 3, 1>>* deltaD)
+{
+    switch (param.kernel) {
+    case linearInterpolation:
+        calDamageGradientKernel<linearKernel>(particles, param, (real)dx, grid, deltaD);
+        break;
+    case cubicInterpolation:
+        calDamageGradientKernel<cubicKernel>(particles, param, (real)dx, grid, deltaD);
+        break;
+    default:
+        calDamageGradientKernel<quadraticKernel>(particles, param, (real)dx, grid, deltaD);
+    }
+};
+
+template void calDamageGradient<double>(std::vector<DamageParticle>*, parametersSim, double, DamageGrid*, std::vector<Eigen::Vector3d>*);
+template void calDamageGradient<float>(std::vector<DamageParticleF>*, parametersSim, double, DamageGridF*, std::vector<Eigen::Vector3f>*);
+
+// calculate the damage gradient of all grid nodes from the normalised node damage values. This gives the exact value.
+// Each node gathers its neighbours with the weights of a particle located at the node. For the linear kernel this is the
+// derivative towards the next node along each axis
+template <class kernel, class real>
+static void calNodeDamageGradientKernel(real dx, DamageGridT<real>* grid)
+{
+    const int w = kernel::width;
+    int offset = 0;
+    real weightVec[w], deltaWeightVec[w];
+    calNodeKernelWeights<kernel>(&offset, weightVec, deltaWeightVec);
+    real nodeWeight[3][w], nodeDeltaWeight[3][w];
+    for (int d = 0; d < 3; d++) {
+        for (int i = 0; i < w; i++) {
+            nodeWeight[d][i] = weightVec[i];
+            nodeDeltaWeight[d][i] = deltaWeightVec[i] / dx;
+        }
+    }
+
+    (*grid).allocateGradient();
+
+    int numNodes = (*grid).numNodes();
+#pragma omp parallel for
+    for (int g = 0; g < numNodes; g++) {
+        int stencil[w * w * w];
+        (*grid).template findStencil<w>((*grid).posIndex(g) + Eigen::Vector3i::Constant(offset), stencil);
+        for (int i = 0; i < w; i++) {
+            for (int j = 0; j < w; j++) {
+                for (int k = 0; k < w; k++) {
+                    int eid = stencil[(i * w + j) * w + k];
+                    if (eid != -1) {
+                        Eigen::Matrix<real, 3, 1> posD = -Eigen::Matrix<real, 3, 1>(offset + i, offset + j, offset + k) * dx;
+                        (*grid).deltaDi(g) += gradientTerm<kernel>::eval(nodeWeight, nodeDeltaWeight, i, j, k, dx, posD, (*grid).Di(eid), real(1.0));
                     };
                 };
             };
         };
-
-        (*nodesVec)[g].Di = (*nodesVec)[g].Di / (*nodesVec)[g].sw;
     };
-};
+}
 
-// calculate the damage gradient of any give point
-Eigen::Vector3d calDamageGradientPoint(Eigen::Vector3d pos, parametersSim param, double dx, std::map<int, int>* gridMap, std::vector<Grid>* nodesVec)
+// calculate the damage gradient of all grid nodes, read afterwards through DamageGridT::deltaDi()
+template <class real>
+void calNodeDamageGradient(DamageGridT<real>* grid, parametersSim param, double dx)
+{
+    switch (param.kernel) {
+    case linearInterpolation:
+        calNodeDamageGradientKernel<linearKernel>((real)dx, grid);
+        break;
+    case cubicInterpolation:
+        calNodeDamageGradientKernel<cubicKernel>((real)dx, grid);
+        break;
+    default:
+        calNodeDamageGradientKernel<quadraticKernel>((real)dx, grid);
+    }
+}
+
+template void calNodeDamageGradient<double>(DamageGrid*, parametersSim, double);
+template void calNodeDamageGradient<float>(DamageGridF*, parametersSim, double);
+
+// the point is evaluated in the precision of the grid
+template <class kernel, class real>
+static Eigen::Matrix<real, 3, 1> calDamageGradientPointKernel(Eigen::Matrix<real, 3, 1> pos, real dx, DamageGridT<real>* grid)
 {
-    Eigen::Vector3d deltaPoint = { 0, 0, 0 };
-    Eigen::Vector3d base = (pos) / dx - Eigen::Vector3d::Constant(0.5);
-    Eigen::Vector3i ppIndex = base.cast<int>();
-
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            for (int k = 0; k < 3; k++) {
-                int ID = calculateID(ppIndex[0] + i, ppIndex[1] + j, ppIndex[2] + k, param.length, dx);
-
-                struct weightAndDreri WD = calWeight(dx, (pos));
-                Eigen::MatrixXd weightPoint = WD.weight;
-                double weight = weightPoint(0, i) * weightPoint(1, j) * weightPoint(2, k);
-
-                if ((*gridMap).find(ID) != (*gridMap).end()) {
-                    int eid = (*gridMap)[ID];
-                    Eigen::Vector3d posD = (pos) - (*nodesVec)[eid].posIndex.cast<double>() * dx;
-                    deltaPoint += weight / (dx * dx / 4) * (*nodesVec)[eid].Di / (*nodesVec)[eid].sw * posD;
+    const int w = kernel::width;
+    Eigen::Matrix<real, 3, 1> deltaPoint = { 0, 0, 0 };
+    kernelWeights<kernel, real> WD = calKernelWeights<kernel>(dx, pos); // evaluated once for the whole stencil
+
+    int stencil[w * w * w];
+    (*grid).template findStencil<w>(WD.ppIndex, stencil);
+    for (int i = 0; i < w; i++) {
+        for (int j = 0; j < w; j++) {
+            for (int k = 0; k < w; k++) {
+                int eid = stencil[(i * w + j) * w + k];
+                if (eid != -1) {
+                    Eigen::Matrix<real, 3, 1> posD = (pos) - (*grid).posIndex(eid).template cast<real>() * dx;
+                    deltaPoint += gradientTerm<kernel>::eval(WD.weight, WD.deltaWeight, i, j, k, dx, posD, (*grid).Di(eid), (*grid).sw(eid));
                 };
             };
         };
     };
 
     return deltaPoint;
+}
+
+// calculate the damage gradient of any give point
+template <class real>
+Eigen::Vector3d calDamageGradientPoint(Eigen::Vector3d pos, parametersSim param, double dx, DamageGridT<real>* grid)
+{
+    switch (param.kernel) {
+    case linearInterpolation:
+        return calDamageGradientPointKernel<linearKernel>(pos.cast<real>().eval(), (real)dx, grid).template cast<double>();
+    case cubicInterpolation:
+        return calDamageGradientPointKernel<cubicKernel>(pos.cast<real>().eval(), (real)dx, grid).template cast<double>();
+    default:
+        return calDamageGradientPointKernel<quadraticKernel>(pos.cast<real>().eval(), (real)dx, grid).template cast<double>();
+    }
 };
 
-// calculate the damage value of any give point
-double calDamageValuePoint(Eigen::Vector3d pos, parametersSim param, double dx, std::map<int, int>* gridMap, std::vector<Grid>* nodesVec)
+template Eigen::Vector3d calDamageGradientPoint<double>(Eigen::Vector3d, parametersSim, double, DamageGrid*);
+template Eigen::Vector3d calDamageGradientPoint<float>(Eigen::Vector3d, parametersSim, double, DamageGridF*);
+
+template <class kernel, class real>
+static real calDamageValuePointKernel(Eigen::Matrix<real, 3, 1> pos, real dx, DamageGridT<real>* grid)
 {
-    double dpValue = 0;
-    Eigen::Vector3d base = (pos) / dx - Eigen::Vector3d::Constant(0.5);
-    Eigen::Vector3i ppIndex = base.cast<int>();
-
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            for (int k = 0; k < 3; k++) {
-                int ID = calculateID(ppIndex[0] + i, ppIndex[1] + j, ppIndex[2] + k, param.length, dx);
-
-                struct weightAndDreri WD = calWeight(dx, (pos));
-                Eigen::MatrixXd weightPoint = WD.weight;
-                double weight = weightPoint(0, i) * weightPoint(1, j) * weightPoint(2, k);
-
-                if ((*gridMap).find(ID) != (*gridMap).end()) {
-                    int eid = (*gridMap)[ID];
-                    Eigen::Vector3d posD = (pos) - (*nodesVec)[eid].posIndex.cast<double>() * dx;
-                    dpValue += weight * (*nodesVec)[eid].Di;
+    const int w = kernel::width;
+    real dpValue = 0;
+    kernelWeights<kernel, real> WD = calKernelWeights<kernel>(dx, pos); // evaluated once for the whole stencil
+
+    int stencil[w * w * w];
+    (*grid).template findStencil<w>(WD.ppIndex, stencil);
+    for (int i = 0; i < w; i++) {
+        for (int j = 0; j < w; j++) {
+            for (int k = 0; k < w; k++) {
+                real weight = WD.weight[0][i] * WD.weight[1][j] * WD.weight[2][k];
+
+                int eid = stencil[(i * w + j) * w + k];
+                if (eid != -1) {
+                    dpValue += weight * (*grid).Di(eid);
                 };
             };
         };
     };
 
     return dpValue;
+}
+
+// calculate the damage value of any give point
+template <class real>
+double calDamageValuePoint(Eigen::Vector3d pos, parametersSim param, double dx, DamageGridT<real>* grid)
+{
+    switch (param.kernel) {
+    case linearInterpolation:
+        return calDamageValuePointKernel<linearKernel>(pos.cast<real>().eval(), (real)dx, grid);
+    case cubicInterpolation:
+        return calDamageValuePointKernel<cubicKernel>(pos.cast<real>().eval(), (real)dx, grid);
+    default:
+        return calDamageValuePointKernel<quadraticKernel>(pos.cast<real>().eval(), (real)dx, grid);
+    }
 };
+
+template double calDamageValuePoint<double>(Eigen::Vector3d, parametersSim, double, DamageGrid*);
+template double calDamageValuePoint<float>(Eigen::Vector3d, parametersSim, double, DamageGridF*);
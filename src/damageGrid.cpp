@@ -0,0 +1,194 @@
+#include "crackExtraction/damageGrid.h"
+
+#include <algorithm>
+
+// node ids of the width x width x width stencil starting at "base"
+template <class real>
+template <int width>
+void DamageGridT<real>::findStencil(const Eigen::Vector3i& base, int* ids) const
+{
+    // the stencil overlaps at most two bricks along each axis
+    int brickOffset[3][width]; // 0 or 1: which of the two bricks along an axis holds the stencil node
+    int slotPart[3][width]; // contribution of the stencil node to the slot
+    for (int d = 0; d < 3; d++) {
+        for (int t = 0; t < width; t++) {
+            brickOffset[d][t] = ((base[d] + t) >> brickBits) - (base[d] >> brickBits);
+            slotPart[d][t] = ((base[d] + t) & (brickSize - 1)) << (d * brickBits);
+        }
+    }
+
+    Eigen::Vector3i firstBrick = brickIndex(base);
+    int brickIds[2][2][2];
+    for (int bi = 0; bi < 2; bi++) {
+        for (int bj = 0; bj < 2; bj++) {
+            for (int bk = 0; bk < 2; bk++) {
+                bool used = (bi == 0 || brickOffset[0][width - 1] == 1) && (bj == 0 || brickOffset[1][width - 1] == 1) && (bk == 0 || brickOffset[2][width - 1] == 1);
+                brickIds[bi][bj][bk] = used ? brickMap.find(NodeHashMap::key(firstBrick[0] + bi, firstBrick[1] + bj, firstBrick[2] + bk)) : -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < width; j++) {
+            for (int k = 0; k < width; k++) {
+                int b = brickIds[brickOffset[0][i]][brickOffset[1][j]][brickOffset[2][k]];
+                int s = slotPart[0][i] | slotPart[1][j] | slotPart[2][k];
+                ids[(i * width + j) * width + k] = b == -1 ? -1 : bricks[b].nodeId[s];
+            }
+        }
+    }
+}
+
+// Activate a node and return its id
+template <class real>
+int DamageGridT<real>::activate(const Eigen::Vector3i& index, bool* inserted)
+{
+    uint64_t key = brickKey(index);
+    if (key != lastBrickKey) {
+        lastBrick = allocateBrick(brickIndex(index));
+        lastBrickKey = key;
+    }
+
+    return activateSlot(lastBrick, slot(index), inserted);
+}
+
+// position of a brick in "bricks", the brick is allocated if needed
+template <class real>
+int DamageGridT<real>::allocateBrick(const Eigen::Vector3i& brick)
+{
+    int b = brickMap.insert(NodeHashMap::key(brick), (int)bricks.size());
+    if (b == (int)bricks.size()) {
+        bricks.push_back(DamageBrick());
+        bricks.back().origin = brick * brickSize;
+        std::fill(bricks.back().nodeId, bricks.back().nodeId + brickNodes, -1);
+    }
+    return b;
+}
+
+// activate node "s" of brick "b" and return its id
+template <class real>
+int DamageGridT<real>::activateSlot(int b, int s, bool* inserted)
+{
+    DamageBrick& brick = bricks[b];
+    bool isNew = (brick.activeMask & (uint64_t(1) << s)) == 0;
+    if (isNew) {
+        const int m = brickSize - 1;
+        brick.activeMask |= uint64_t(1) << s;
+        brick.nodeId[s] = (int)posIndices.size();
+        posIndices.push_back(brick.origin + Eigen::Vector3i(s & m, (s >> brickBits) & m, s >> (2 * brickBits)));
+        DiValues.push_back(0);
+        swValues.push_back(0);
+        for (int c = 0; c < numChannels; c++) {
+            labelValues[c].push_back(0);
+        }
+    }
+    if (inserted != nullptr) {
+        *inserted = isNew;
+    }
+
+    return brick.nodeId[s];
+}
+
+// make room for n nodes
+template <class real>
+void DamageGridT<real>::reserve(int n)
+{
+    posIndices.reserve(n);
+    DiValues.reserve(n);
+    swValues.reserve(n);
+    for (int c = 0; c < numChannels; c++) {
+        labelValues[c].reserve(n);
+    }
+}
+
+// Grow the occupancy masks of all bricks by one node along an axis. Inside a brick the nodes move by a shift of the
+// mask; the nodes on a face of the brick move into the neighbouring brick, which is allocated if needed
+template <class real>
+void DamageGridT<real>::dilateMasks(int axis, std::vector<uint64_t>* masks)
+{
+    // the nodes on the low and on the high face of a brick along each axis
+    const uint64_t lowFace[3] = { UINT64_C(0x1111111111111111), UINT64_C(0x000F000F000F000F), UINT64_C(0x000000000000FFFF) };
+    const uint64_t highFace[3] = { UINT64_C(0x8888888888888888), UINT64_C(0xF000F000F000F000), UINT64_C(0xFFFF000000000000) };
+    const int stride = 1 << (axis * brickBits); // slot distance of two neighbouring nodes along the axis
+    const int across = (brickSize - 1) * stride; // slot distance of the two faces
+
+    std::vector<uint64_t> grown(*masks);
+    int numBricks = (int)(*masks).size();
+    for (int b = 0; b < numBricks; b++) {
+        uint64_t m = (*masks)[b];
+        if (m == 0) {
+            continue;
+        }
+
+        grown[b] |= ((m << stride) & ~lowFace[axis]) | ((m >> stride) & ~highFace[axis]);
+
+        for (int pn = 0; pn < 2; pn++) {
+            uint64_t face = m & (pn == 0 ? lowFace[axis] : highFace[axis]);
+            if (face != 0) {
+                Eigen::Vector3i neighbour = brickIndex(bricks[b].origin);
+                neighbour[axis] += 2 * pn - 1;
+                int n = allocateBrick(neighbour);
+                grown.resize(bricks.size(), 0);
+                grown[n] |= pn == 0 ? face << across : face >> across;
+            }
+        }
+    }
+    (*masks).swap(grown);
+}
+
+// Label the nodes within "numShells" nodes of a channel's region with 1 + their distance to the region
+template <class real>
+void DamageGridT<real>::dilate(int channel, int numShells)
+{
+    // reach[d]: the nodes within distance d of the region, one bit per node of each brick
+    std::vector<std::vector<uint64_t>> reach(numShells + 1);
+    reach[0].assign(bricks.size(), 0);
+    for (int b = 0; b < (int)bricks.size(); b++) {
+        for (int s = 0; s < brickNodes; s++) {
+            if ((bricks[b].activeMask >> s & 1) != 0 && labelValues[channel][bricks[b].nodeId[s]] == 1) {
+                reach[0][b] |= uint64_t(1) << s;
+            }
+        }
+    }
+
+    // a step in the maximum norm is a step along each of the three axes
+    for (int d = 1; d <= numShells; d++) {
+        reach[d] = reach[d - 1];
+        for (int axis = 0; axis < 3; axis++) {
+            dilateMasks(axis, &reach[d]);
+        }
+    }
+    for (int d = 0; d <= numShells; d++) {
+        reach[d].resize(bricks.size(), 0);
+    }
+
+    for (int b = 0; b < (int)bricks.size(); b++) {
+        uint64_t shells = reach[numShells][b] & ~reach[0][b];
+        for (int s = 0; s < brickNodes; s++) {
+            if ((shells >> s & 1) == 0) {
+                continue;
+            }
+
+            int distance = 1;
+            while ((reach[distance][b] >> s & 1) == 0) {
+                distance += 1;
+            }
+
+            int eid = activateSlot(b, s, nullptr);
+            unsigned char& label = labelValues[channel][eid];
+            if (label == 0 || label > 1 + distance) {
+                label = (unsigned char)(1 + distance);
+            }
+        }
+    }
+}
+
+template class DamageGridT<double>;
+template class DamageGridT<float>;
+
+template void DamageGridT<double>::findStencil<2>(const Eigen::Vector3i&, int*) const;
+template void DamageGridT<double>::findStencil<3>(const Eigen::Vector3i&, int*) const;
+template void DamageGridT<double>::findStencil<4>(const Eigen::Vector3i&, int*) const;
+template void DamageGridT<float>::findStencil<2>(const Eigen::Vector3i&, int*) const;
+template void DamageGridT<float>::findStencil<3>(const Eigen::Vector3i&, int*) const;
+template void DamageGridT<float>::findStencil<4>(const Eigen::Vector3i&, int*) const;
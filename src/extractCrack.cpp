@@ -1,5 +1,7 @@
 ﻿#include "crackExtraction/extractCrack.h"
 
+#include <omp.h>
+
 using namespace voro;
 using namespace Eigen;
 using namespace std;
@@ -83,78 +85,44 @@ std::vector<std::string> split(const std::string& s, const std::string& seperato
     return result;
 }
 
-// Set the damage phase of a grid node vector into a specific value
-void setNodeValue(std::vector<Grid>* nodesVec, int va)
+// Label the nodes touched by the particles in the occupancy channels of the grid. Every node is touched by some
+// particle, the nodes with damage were touched by a fully damaged particle (Dp == 1)
+template <class real>
+void setOccupancy(DamageGridT<real>* grid)
 {
-    int numDamage = (*nodesVec).size();
+    int numDamage = (*grid).numNodes();
+#pragma omp parallel for
     for (int k = 0; k < numDamage; k++) {
-        (*nodesVec)[k].Di = va;
+        (*grid).label(DamageGrid::allParticlesChannel, k) = 1;
+        (*grid).label(DamageGrid::fullyDamagedChannel, k) = (*grid).Di(k) > 0 ? 1 : 0;
     }
 }
 
-// Find the bounding box boundary nodes and set its damage phase into a specific value
-void findBoundaryNodes(std::vector<Particle>* particles, std::vector<Grid>* nodesVec, std::map<int, int>* gridMap, struct parametersSim parti, int va)
-{
-
-    int count1 = (*nodesVec).size();
-    int numDamage = (*nodesVec).size();
-    for (int m = 0; m < numDamage; m++) {
-        for (int i = -1; i < 2; i++) {
-            for (int j = -1; j < 2; j++) {
-                for (int k = -1; k < 2; k++) {
-
-                    int ID = calculateID((*nodesVec)[m].posIndex[0] + i, (*nodesVec)[m].posIndex[1] + j, (*nodesVec)[m].posIndex[2] + k, parti.length, parti.dx);
-                    if ((*gridMap).find(ID) == (*gridMap).end()) {
-                        (*gridMap)[ID] = count1;
-                        (*nodesVec).push_back(Grid(0.0));
-
-                        (*nodesVec)[count1].posIndex = { (*nodesVec)[m].posIndex[0] + i, (*nodesVec)[m].posIndex[1] + j, (*nodesVec)[m].posIndex[2] + k };
-                        (*nodesVec)[count1].Di = va;
-
-                        count1 += 1;
-                    }
-                }
-            }
-        }
-    }
-}
+template void setOccupancy<double>(DamageGrid*);
+template void setOccupancy<float>(DamageGridF*);
 
-// Read particles' positions and damage phases
-void readParticles(std::vector<Particle>* particlesRaw, std::vector<Particle>* particles, bool ifFully, struct parametersSim param)
+template <class kernel, class real>
+static double ifFullyDamagedKernel(Eigen::Vector3d pos, parametersSim param, DamageGridT<real>* grid)
 {
-
-    for (int i = 0; i < (*particlesRaw).size(); i++) {
-        if (ifFully == true) {
-            if ((*particlesRaw)[i].Dp >= param.damageThreshold) {
-                (*particles).push_back(Particle((*particlesRaw)[i].pos, (*particlesRaw)[i].vel, 0, 0, 1));
-            }
-        } else {
-            (*particles).push_back(Particle((*particlesRaw)[i].pos, (*particlesRaw)[i].vel, 0, 0, 1));
-        }
-    }
-}
-
-// Calculate the damage value of any point and return the value
-double ifFullyDamaged(Eigen::Vector3d pos, parametersSim param, std::map<int, int>* gridMap, std::vector<Grid>* nodesVec)
-{
-    double damageValue = 0;
-    Eigen::Vector3d base = pos / param.dx - Eigen::Vector3d::Constant(0.5);
-    Eigen::Vector3i ppIndex = base.cast<int>();
+    const int w = kernel::width;
+    const int fullyDamagedNodes = kernel::fullyDamagedNodes;
+    real damageValue = 0;
+    kernelWeights<kernel, real> WD = calKernelWeights<kernel>((real)param.dx, pos.cast<real>().eval()); // evaluated once for the whole stencil
+    Eigen::Vector3i ppIndex = WD.ppIndex;
 
     int countFullyDamaged = 0;
 
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            for (int k = 0; k < 3; k++) {
-                int ID = calculateID(ppIndex[0] + i, ppIndex[1] + j, ppIndex[2] + k, param.length, param.dx);
-                struct weightAndDreri WD = calWeight(param.dx, pos);
-                MatrixXd weightPoint = WD.weight;
-                double weight = weightPoint(0, i) * weightPoint(1, j) * weightPoint(2, k);
-
-                if ((*gridMap).find(ID) != (*gridMap).end()) {
-                    int eid = (*gridMap)[ID];
-                    damageValue += weight * (*nodesVec)[eid].Di;
-                    if ((*nodesVec)[eid].Di == 1) {
+    int stencil[w * w * w];
+    (*grid).template findStencil<w>(ppIndex, stencil);
+    for (int i = 0; i < w; i++) {
+        for (int j = 0; j < w; j++) {
+            for (int k = 0; k < w; k++) {
+                real weight = WD.weight[0][i] * WD.weight[1][j] * WD.weight[2][k];
+
+                int eid = stencil[(i * w + j) * w + k];
+                if (eid != -1) {
+                    damageValue += weight * (*grid).Di(eid);
+                    if ((*grid).Di(eid) == 1) {
                         countFullyDamaged += 1;
                     }
                 }
@@ -162,13 +130,30 @@ double ifFullyDamaged(Eigen::Vector3d pos, parametersSim param, std::map<int, in
         };
     };
 
-    if (countFullyDamaged >= 8) {
+    if (countFullyDamaged >= fullyDamagedNodes) {
         damageValue = 1.0;
     }
 
     return damageValue;
 }
 
+// Calculate the damage value of any point and return the value
+template <class real>
+double ifFullyDamaged(Eigen::Vector3d pos, parametersSim param, DamageGridT<real>* grid)
+{
+    switch (param.kernel) {
+    case linearInterpolation:
+        return ifFullyDamagedKernel<linearKernel>(pos, param, grid);
+    case cubicInterpolation:
+        return ifFullyDamagedKernel<cubicKernel>(pos, param, grid);
+    default:
+        return ifFullyDamagedKernel<quadraticKernel>(pos, param, grid);
+    }
+}
+
+template double ifFullyDamaged<double>(Eigen::Vector3d, parametersSim, DamageGrid*);
+template double ifFullyDamaged<float>(Eigen::Vector3d, parametersSim, DamageGridF*);
+
 // Store the index of each vertex and its position
 int findIndexVertex(Eigen::Vector3d pos, std::vector<Eigen::Vector3d>* vertexIndex)
 {
@@ -178,181 +163,66 @@ int findIndexVertex(Eigen::Vector3d pos, std::vector<Eigen::Vector3d>* vertexInd
     return index;
 }
 
-// Read all structured nodes and calculate the damage gradient
-void readParticlesAndCalGradient(std::vector<Grid>* fullyDamagedParticlesNodesVec, std::vector<Particle>* particles, parametersSim param, std::map<int, int>* gridMap, std::vector<Grid>* nodesVec)
+template <class kernel, class real>
+static void smoothFullyDamagedKernel(DamageGridT<real>* grid)
 {
-    for (int i = 0; i < (*fullyDamagedParticlesNodesVec).size(); i++) {
-        if ((*fullyDamagedParticlesNodesVec)[i].Di == 1) {
-            Eigen::Vector3d ipos = { (*fullyDamagedParticlesNodesVec)[i].posIndex[0] * param.dx, (*fullyDamagedParticlesNodesVec)[i].posIndex[1] * param.dx, (*fullyDamagedParticlesNodesVec)[i].posIndex[2] * param.dx };
-            Eigen::Vector3d ivel = { 0, 0, 0 };
-            (*particles).push_back(Particle(ipos, ivel, 0, 0, 1));
-        }
-
-        if ((*fullyDamagedParticlesNodesVec)[i].Di == 2) {
-            Eigen::Vector3d ipos = { (*fullyDamagedParticlesNodesVec)[i].posIndex[0] * param.dx, (*fullyDamagedParticlesNodesVec)[i].posIndex[1] * param.dx, (*fullyDamagedParticlesNodesVec)[i].posIndex[2] * param.dx };
-            Eigen::Vector3d ivel = { 0, 0, 0 };
-            (*particles).push_back(Particle(ipos, ivel, 0, 0, 0));
-        }
-    }
-
-    calDamageGradient(particles, param, param.dx, gridMap, nodesVec);
-}
-
-// Find paths between two nodes
-bool findPath(Eigen::Vector3d startNode, Eigen::Vector3d stopNode, parametersSim param, std::vector<Grid>* fullyDamagedParticlesNodesVec, std::map<int, int>* fullyDamagedParticlesGridMap, std::vector<int>* surfaceNodesID)
-{
-
-    Eigen::Vector3d startNodePos = startNode / param.dx;
-    Eigen::Vector3i startNodeIndex;
-    startNodeIndex[0] = round(startNodePos[0]);
-    startNodeIndex[1] = round(startNodePos[1]);
-    startNodeIndex[2] = round(startNodePos[2]);
-    int startNodeID = calculateID(startNodeIndex[0], startNodeIndex[1], startNodeIndex[2], param.length, param.dx);
-
-    Eigen::Vector3d stopNodePos = stopNode / param.dx;
-    Eigen::Vector3i stopNodeIndex;
-    stopNodeIndex[0] = round(stopNodePos[0]);
-    stopNodeIndex[1] = round(stopNodePos[1]);
-    stopNodeIndex[2] = round(stopNodePos[2]);
-    int stopNodeID = calculateID(stopNodeIndex[0], stopNodeIndex[1], stopNodeIndex[2], param.length, param.dx);
-
-    Eigen::Vector3i boundingBox = stopNodeIndex - startNodeIndex;
-    int maxAllowedSteps = abs(boundingBox[0]) + abs(boundingBox[1]) + abs(boundingBox[2]);
-
-    // if a particle has no neighbours
-    bool noNeighbours = false;
-
-    std::vector<Eigen::Vector3i> visitQueueIndex; // stores node posIndexs that should be visited
-    std::map<int, int> IDMap; // the key is the ID of a node, the value is the node's position in std::vector nodeNeighbour
-    std::vector<std::vector<int>> nodeParent; // stores parent-layer neighbouring information of nodes
-
-    // Initialize all vectors with starting node
-    visitQueueIndex.push_back(startNodeIndex);
-    IDMap[startNodeID] = 0;
-    std::vector<int> startNodeParent;
-    startNodeParent.push_back(-99);
-    nodeParent.push_back(startNodeParent); // start node has no parent-layer, so give a negative value
-
-    bool reachMaxmiumBoundingBox = false; // if the expansion layer reach the maximum bounding box
-    bool reachStopNode = false;
-    int lastLayerPos = 0, lastLayerLength = 1;
-
-    //////////////
-    int depth = 0; // the number of step used
-
-    do {
-
-        std::vector<Eigen::Vector3i> visitQueueIndexLayer;
-        std::vector<std::vector<int>> nodeParentLayer;
-        int lengthOfALayer = 0;
-
-        for (int k = lastLayerPos; k < lastLayerPos + lastLayerLength; k++) {
-            Eigen::Vector3i parentNodeIndex = visitQueueIndex[k]; // the node that is going to be visited
-            int parentNodeID = calculateID(parentNodeIndex[0], parentNodeIndex[1], parentNodeIndex[2], param.length, param.dx);
-
-            for (int axis = 0; axis < 3; axis++) // three axis directions
-            {
-                for (int pn = 0; pn < 2; pn++) {
-                    Eigen::Vector3i normal = { 0, 0, 0 };
-                    normal[axis] = 2 * pn - 1;
-                    Eigen::Vector3i neighbourNodePosIndex = parentNodeIndex + normal;
-
-                    int neighbourNodeID = calculateID(neighbourNodePosIndex[0], neighbourNodePosIndex[1], neighbourNodePosIndex[2], param.length, param.dx);
-                    if (IDMap.find(neighbourNodeID) == IDMap.end()) // this node is not in the queue
-                    {
-                        if ((*fullyDamagedParticlesGridMap).find(neighbourNodeID) != (*fullyDamagedParticlesGridMap).end()) {
-                            int eid = (*fullyDamagedParticlesGridMap)[neighbourNodeID];
-                            if ((*fullyDamagedParticlesNodesVec)[eid].Di == 2) // if this node is a boundary shell
-                            {
-                                visitQueueIndexLayer.push_back(neighbourNodePosIndex);
-                                IDMap[neighbourNodeID] = lengthOfALayer + lastLayerPos + lastLayerLength;
-
-                                // find the neghbours of this node in the last layer
-                                std::vector<int> aSingleNodeParent;
-                                for (int nt = lastLayerPos; nt < lastLayerPos + lastLayerLength; nt++) {
-                                    Eigen::Vector3i lastLayerNode = visitQueueIndex[nt];
-                                    Eigen::Vector3i diffIndex = lastLayerNode - neighbourNodePosIndex;
-                                    int sumDiff = abs(diffIndex[0]) + abs(diffIndex[1]) + abs(diffIndex[2]);
-                                    if (sumDiff == 1) {
-                                        int lastLayerNodeID = calculateID(lastLayerNode[0], lastLayerNode[1], lastLayerNode[2], param.length, param.dx);
-                                        aSingleNodeParent.push_back(lastLayerNodeID);
-                                    }
-                                }
-                                nodeParentLayer.push_back(aSingleNodeParent);
-                                lengthOfALayer += 1;
-
-                                if (neighbourNodeID == stopNodeID) {
-                                    reachStopNode = true;
-                                }
-                            }
+    const int w = kernel::width;
+    const int channel = DamageGrid::fullyDamagedChannel;
+    int offset = 0;
+    real weightVec[w];
+    calNodeKernelWeights<kernel>(&offset, weightVec);
+
+    int numDamage = (*grid).numNodes();
+#pragma omp parallel for
+    for (int n = 0; n < numDamage; n++) {
+        real damage = 0, sw = 0;
+        if ((*grid).label(channel, n) != 0) {
+            // the node gathers the points at the nodes whose stencil contains it
+            int stencil[w * w * w];
+            (*grid).template findStencil<w>((*grid).posIndex(n) - Eigen::Vector3i::Constant(offset + w - 1), stencil);
+            for (int i = 0; i < w; i++) {
+                for (int j = 0; j < w; j++) {
+                    for (int k = 0; k < w; k++) {
+                        int eid = stencil[(i * w + j) * w + k];
+                        if (eid != -1 && ((*grid).label(channel, eid) == 1 || (*grid).label(channel, eid) == 2)) {
+                            real weight = weightVec[w - 1 - i] * weightVec[w - 1 - j] * weightVec[w - 1 - k];
+                            damage += ((*grid).label(channel, eid) == 1) ? weight : 0;
+                            sw += weight;
                         }
                     }
                 }
             }
         }
-        lastLayerPos = visitQueueIndex.size();
-        lastLayerLength = lengthOfALayer;
-        visitQueueIndex.insert(visitQueueIndex.end(), visitQueueIndexLayer.begin(), visitQueueIndexLayer.end());
-        nodeParent.insert(nodeParent.end(), nodeParentLayer.begin(), nodeParentLayer.end());
-
-        depth += 1;
-
-        if (lastLayerLength == 0) {
-            return true;
-        }
-
-        if (depth >= round(1.3 * (double)maxAllowedSteps) && reachStopNode == false) {
-            return true;
-        }
-
-    } while (reachStopNode == false && noNeighbours == false);
-
-    //// Finding all possible paths
-    std::vector<std::vector<int>> paths;
-    bool reachStartNode = false;
-
-    std::vector<int> initializeStop;
-    initializeStop.push_back(stopNodeID);
-    paths.push_back(initializeStop);
-    int pathSize = paths.size();
-
-    do {
-        int nextLayerSize = 0;
-        for (int k = 0; k < pathSize; k++) {
-            std::vector<int> partialPath = paths[k];
-            std::vector<int> lastNodeParents = nodeParent[IDMap[paths[k].back()]];
-
-            for (int m = 0; m < lastNodeParents.size(); m++) {
-
-                if (count((*surfaceNodesID).begin(), (*surfaceNodesID).end(), lastNodeParents[m]) == 0) {
-                    //std::vector<int> partialPathExtend = partialPath;
-                    std::vector<int> partialPathExtend;
-                    partialPathExtend.push_back(lastNodeParents[m]);
-
-                    if (lastNodeParents[m] == startNodeID) {
-                        reachStartNode = true;
-                        return false;
-                    }
-
-                    paths.push_back(partialPathExtend);
-                    nextLayerSize += 1;
-                }
-            }
-        }
 
-        paths.erase(paths.begin(), paths.begin() + pathSize);
-        pathSize = nextLayerSize;
-        //cout <<"pathSize = "<< pathSize << endl;
-
-    } while (reachStartNode == false && pathSize != 0);
+        (*grid).Di(n) = sw == 0 ? 0 : damage / sw;
+        (*grid).sw(n) = sw;
+    }
+}
 
-    if (reachStartNode == false) {
-        return true;
+// Smooth the fully damaged region onto the grid nodes. Each node of the region (label 1) and of its first shell (label
+// 2) acts as a point at the node with damage 1 or 0, and the damage of a node is the weighted mean of the points whose
+// kernel stencil contains it. For the quadratic B-spline a point at a node has the weights {0.125, 0.75, 0.125} along
+// each axis. Nodes out of reach of these points get no damage
+template <class real>
+void smoothFullyDamaged(DamageGridT<real>* grid, parametersSim param)
+{
+    switch (param.kernel) {
+    case linearInterpolation:
+        smoothFullyDamagedKernel<linearKernel>(grid);
+        break;
+    case cubicInterpolation:
+        smoothFullyDamagedKernel<cubicKernel>(grid);
+        break;
+    default:
+        smoothFullyDamagedKernel<quadraticKernel>(grid);
     }
 }
 
+template void smoothFullyDamaged<double>(DamageGrid*, parametersSim);
+template void smoothFullyDamaged<float>(DamageGridF*, parametersSim);
+
 // Find if a pair of nodes belong to critical nodes. The function return true if one node is a critical node
-bool ifCriticalNode(Eigen::Vector3d node1, parametersSim param, std::vector<int>* criticalNodeIndex)
+bool ifCriticalNode(Eigen::Vector3d node1, parametersSim param, NodeHashMap* criticalNodes)
 {
 
     Eigen::Vector3d node1Pos = node1 / param.dx;
@@ -360,9 +230,8 @@ bool ifCriticalNode(Eigen::Vector3d node1, parametersSim param, std::vector<int>
     node1Index[0] = round(node1Pos[0]);
     node1Index[1] = round(node1Pos[1]);
     node1Index[2] = round(node1Pos[2]);
-    int node1ID = calculateID(node1Index[0], node1Index[1], node1Index[2], param.length, param.dx);
 
-    if (count((*criticalNodeIndex).begin(), (*criticalNodeIndex).end(), node1ID) != 0) {
+    if ((*criticalNodes).contains(node1Index)) {
         return true;
     } else {
         return false;
@@ -370,20 +239,19 @@ bool ifCriticalNode(Eigen::Vector3d node1, parametersSim param, std::vector<int>
 }
 
 // Find the nearest boundary node of a critical node
-Eigen::Vector3i findNearestBoundaryNode(int nodeIDPoint, std::vector<Point>* points, std::vector<int>* boundaryNodesID, std::vector<Eigen::Vector3i>* boundaryNodesPosIndex, std::map<int, int>* pointIndexFind, parametersSim param, std::vector<int>* criticalNodeIndex)
+Eigen::Vector3i findNearestBoundaryNode(int nodeIDPoint, std::vector<Eigen::Vector3i>* boundaryNodesPosIndex, NodeHashMap* pointIndexFind, parametersSim param, NodeHashMap* criticalNodes)
 {
     Eigen::Vector3i nodeIndex = (*boundaryNodesPosIndex)[nodeIDPoint];
-    int nodeID = (*boundaryNodesID)[nodeIDPoint];
 
     bool reachNearest = false;
 
     std::vector<Eigen::Vector3i> visitQueueIndex; // stores node posIndexs that should be visited
-    std::map<int, int> IDMap; // the key is the ID of a node, the value is the node's position in std::vector nodeNeighbour
-    std::vector<std::vector<int>> nodeParent; // stores parent-layer neighbouring information of nodes
+    NodeHashMap IDMap; // the key is a node, the value is the node's position in std::vector visitQueueIndex
+    std::vector<std::vector<int>> nodeParent; // stores the queue positions of each node's parent-layer neighbours
 
     // Initialize all vectors with starting node
     visitQueueIndex.push_back(nodeIndex);
-    IDMap[nodeID] = 0;
+    IDMap.insert(nodeIndex, 0);
     std::vector<int> startNodeParent;
     startNodeParent.push_back(-99);
     nodeParent.push_back(startNodeParent); // start node has no parent-layer, so give a negative value
@@ -400,7 +268,6 @@ Eigen::Vector3i findNearestBoundaryNode(int nodeIDPoint, std::vector<Point>* poi
 
         for (int k = lastLayerPos; k < lastLayerPos + lastLayerLength; k++) {
             Eigen::Vector3i parentNodeIndex = visitQueueIndex[k]; // the node that is going to be visited
-            int parentNodeID = calculateID(parentNodeIndex[0], parentNodeIndex[1], parentNodeIndex[2], param.length, param.dx);
 
             for (int axis = 0; axis < 3; axis++) // three axis directions
             {
@@ -409,13 +276,12 @@ Eigen::Vector3i findNearestBoundaryNode(int nodeIDPoint, std::vector<Point>* poi
                     normal[axis] = 2 * pn - 1;
                     Eigen::Vector3i neighbourNodePosIndex = parentNodeIndex + normal;
 
-                    int neighbourNodeID = calculateID(neighbourNodePosIndex[0], neighbourNodePosIndex[1], neighbourNodePosIndex[2], param.length, param.dx);
-                    if (IDMap.find(neighbourNodeID) == IDMap.end()) // this node is not in the queue
+                    if (IDMap.contains(neighbourNodePosIndex) == false) // this node is not in the queue
                     {
 
-                        if (count((*boundaryNodesID).begin(), (*boundaryNodesID).end(), neighbourNodeID) != 0) {
+                        if ((*pointIndexFind).contains(neighbourNodePosIndex)) {
                             visitQueueIndexLayer.push_back(neighbourNodePosIndex);
-                            IDMap[neighbourNodeID] = lengthOfALayer + lastLayerPos + lastLayerLength;
+                            IDMap.insert(neighbourNodePosIndex, lengthOfALayer + lastLayerPos + lastLayerLength);
 
                             // find the neghbours of this node in the last layer
                             std::vector<int> aSingleNodeParent;
@@ -424,14 +290,13 @@ Eigen::Vector3i findNearestBoundaryNode(int nodeIDPoint, std::vector<Point>* poi
                                 Eigen::Vector3i diffIndex = lastLayerNode - neighbourNodePosIndex;
                                 int sumDiff = abs(diffIndex[0]) + abs(diffIndex[1]) + abs(diffIndex[2]);
                                 if (sumDiff == 1) {
-                                    int lastLayerNodeID = calculateID(lastLayerNode[0], lastLayerNode[1], lastLayerNode[2], param.length, param.dx);
-                                    aSingleNodeParent.push_back(lastLayerNodeID);
+                                    aSingleNodeParent.push_back(nt);
                                 }
                             }
                             nodeParentLayer.push_back(aSingleNodeParent);
                             lengthOfALayer += 1;
 
-                            if (ifCriticalNode(neighbourNodePosIndex.cast<double>() * param.dx, param, criticalNodeIndex) == false) {
+                            if (ifCriticalNode(neighbourNodePosIndex.cast<double>() * param.dx, param, criticalNodes) == false) {
                                 return neighbourNodePosIndex;
                             }
                         }
@@ -453,29 +318,28 @@ Eigen::Vector3i findNearestBoundaryNode(int nodeIDPoint, std::vector<Point>* poi
     } while (reachNearest == false);
 }
 
-// Judge if a pair of points are on different sides of a crack
-bool ifTwoSides(int startNode, int stopNode, std::vector<Point>* points, std::vector<int>* boundaryNodesID, std::vector<Eigen::Vector3i>* boundaryNodesPosIndex, std::map<int, int>* pointIndexFind, parametersSim param, std::vector<int>* criticalNodeIndex)
+// Judge if a pair of points are on different sides of a crack, given the neighbours already found on the same and on
+// the other side of each point
+bool ifTwoSides(int startNode, int stopNode, NeighbourLists* sameSide, NeighbourLists* otherSide, std::vector<Eigen::Vector3i>* boundaryNodesPosIndex, NodeHashMap* pointIndexFind, parametersSim param, NodeHashMap* criticalNodes)
 {
 
     Eigen::Vector3i startNodeIndex = (*boundaryNodesPosIndex)[startNode];
-    startNodeIndex = findNearestBoundaryNode(startNode, points, boundaryNodesID, boundaryNodesPosIndex, pointIndexFind, param, criticalNodeIndex);
+    startNodeIndex = findNearestBoundaryNode(startNode, boundaryNodesPosIndex, pointIndexFind, param, criticalNodes);
     // if this point is a desolate critical point, return true. Keep this face though it may become a tooth.
     if (startNodeIndex[0] < 0) {
         return true;
     }
-    int startNodeID = calculateID(startNodeIndex[0], startNodeIndex[1], startNodeIndex[2], param.length, param.dx);
-    int startNodePointIndex = (*pointIndexFind)[startNodeID];
+    int startNodePointIndex = (*pointIndexFind).find(startNodeIndex);
 
     Eigen::Vector3i stopNodeIndex = (*boundaryNodesPosIndex)[stopNode];
-    if (ifCriticalNode(stopNodeIndex.cast<double>() * param.dx, param, criticalNodeIndex) == true) {
-        stopNodeIndex = findNearestBoundaryNode(stopNode, points, boundaryNodesID, boundaryNodesPosIndex, pointIndexFind, param, criticalNodeIndex);
+    if (ifCriticalNode(stopNodeIndex.cast<double>() * param.dx, param, criticalNodes) == true) {
+        stopNodeIndex = findNearestBoundaryNode(stopNode, boundaryNodesPosIndex, pointIndexFind, param, criticalNodes);
         // if this point is a desolate critical point, return true. Keep this face though it may become a tooth.
         if (stopNodeIndex[0] < 0) {
             return true;
         }
     }
-    int stopNodeID = calculateID(stopNodeIndex[0], stopNodeIndex[1], stopNodeIndex[2], param.length, param.dx);
-    int stopNodePointIndex = (*pointIndexFind)[stopNodeID];
+    int stopNodePointIndex = (*pointIndexFind).find(stopNodeIndex);
 
     //cout << "Real start and stop points are: " << endl;
     //cout << "startNodeIndex = "<< startNodePointIndex <<" pos "<< startNodeIndex[0] << " " << startNodeIndex[1] << " " << startNodeIndex[2] << " " << endl;
@@ -492,10 +356,8 @@ bool ifTwoSides(int startNode, int stopNode, std::vector<Point>* points, std::ve
                     Eigen::Vector3i normal = { i, j, k };
                     Eigen::Vector3i neighbourNodePosIndex = startNodeIndex + normal;
 
-                    int neighbourNodeID = calculateID(neighbourNodePosIndex[0], neighbourNodePosIndex[1], neighbourNodePosIndex[2], param.length, param.dx);
-
-                    if (count((*boundaryNodesID).begin(), (*boundaryNodesID).end(), neighbourNodeID) != 0) {
-                        int neighbourNodePointIndex = (*pointIndexFind)[neighbourNodeID];
+                    int neighbourNodePointIndex = (*pointIndexFind).find(neighbourNodePosIndex);
+                    if (neighbourNodePointIndex != -1) {
                         sameSideNeighbours.push_back(neighbourNodePointIndex);
                     }
                 }
@@ -504,16 +366,16 @@ bool ifTwoSides(int startNode, int stopNode, std::vector<Point>* points, std::ve
     }
 
     // find the same side neighbours of this point
-    for (int f = 0; f < (*points)[startNodePointIndex].neighbourSameSide.size(); f++) {
-        int sameSideNeighbourPoint = (*points)[startNodePointIndex].neighbourSameSide[f];
+    for (int f = (*sameSide).first(startNodePointIndex); f != -1; f = (*sameSide).next(f)) {
+        int sameSideNeighbourPoint = (*sameSide).neighbour(f);
         if (count(sameSideNeighbours.begin(), sameSideNeighbours.end(), sameSideNeighbourPoint) == 0) {
             sameSideNeighbours.push_back(sameSideNeighbourPoint);
         }
     }
 
     // find the other side neighbours of this point
-    for (int f = 0; f < (*points)[startNodePointIndex].neighbourOtherSide.size(); f++) {
-        int otherSideNeighbourPoint = (*points)[startNodePointIndex].neighbourOtherSide[f];
+    for (int f = (*otherSide).first(startNodePointIndex); f != -1; f = (*otherSide).next(f)) {
+        int otherSideNeighbourPoint = (*otherSide).neighbour(f);
         if (count(otherSideNeighbours.begin(), otherSideNeighbours.end(), otherSideNeighbourPoint) == 0) {
             otherSideNeighbours.push_back(otherSideNeighbourPoint);
         }
@@ -544,8 +406,8 @@ bool ifTwoSides(int startNode, int stopNode, std::vector<Point>* points, std::ve
             int nodePointIndex = sameSideNeighbours[s];
 
             // find the same side neighbours
-            for (int k = 0; k < (*points)[nodePointIndex].neighbourSameSide.size(); k++) {
-                int sameSideNeighbourID = (*points)[nodePointIndex].neighbourSameSide[k];
+            for (int k = (*sameSide).first(nodePointIndex); k != -1; k = (*sameSide).next(k)) {
+                int sameSideNeighbourID = (*sameSide).neighbour(k);
 
                 if (sameSideNeighbourID == stopNodePointIndex) {
                     return false;
@@ -557,8 +419,8 @@ bool ifTwoSides(int startNode, int stopNode, std::vector<Point>* points, std::ve
             }
 
             // find the other side neighbours
-            for (int m = 0; m < (*points)[nodePointIndex].neighbourOtherSide.size(); m++) {
-                int otherSideNeighbourID = (*points)[nodePointIndex].neighbourOtherSide[m];
+            for (int m = (*otherSide).first(nodePointIndex); m != -1; m = (*otherSide).next(m)) {
+                int otherSideNeighbourID = (*otherSide).neighbour(m);
 
                 if (otherSideNeighbourID == stopNodePointIndex) {
 
@@ -577,8 +439,8 @@ bool ifTwoSides(int startNode, int stopNode, std::vector<Point>* points, std::ve
 
             int nodePointIndex = otherSideNeighbours[s];
             // find the same side neighbours; "The same" means in the other crack side
-            for (int k = 0; k < (*points)[nodePointIndex].neighbourSameSide.size(); k++) {
-                int sameSideNeighbourID = (*points)[nodePointIndex].neighbourSameSide[k];
+            for (int k = (*sameSide).first(nodePointIndex); k != -1; k = (*sameSide).next(k)) {
+                int sameSideNeighbourID = (*sameSide).neighbour(k);
                 if (sameSideNeighbourID == stopNodePointIndex) {
                     return true;
                 }
@@ -617,126 +479,219 @@ bool ifTwoSides(int startNode, int stopNode, std::vector<Point>* points, std::ve
     } while (findStopNode == false);
 }
 
-// Extract the crack surface
-std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extractCrackSurface(std::vector<Particle>* particlesRaw, struct parametersSim param)
+// Indices of the items 0 to n - 1 for which keep(m) is true, in increasing order. The items are tested in parallel
+// chunks whose results are joined in chunk order, so the result does not depend on the number of threads
+template <class predicate>
+static std::vector<int> parallelSelect(int n, predicate keep)
+{
+    // small sets are not worth splitting
+    int numChunks = std::max(1, std::min(omp_get_max_threads(), n / 4096));
+    std::vector<std::vector<int>> chunkSelected(numChunks);
+#pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numChunks; c++) {
+        int begin = (int)((int64_t)n * c / numChunks);
+        int end = (int)((int64_t)n * (c + 1) / numChunks);
+        for (int m = begin; m < end; m++) {
+            if (keep(m)) {
+                chunkSelected[c].push_back(m);
+            }
+        }
+    }
+
+    std::vector<int> selected;
+    for (int c = 0; c < numChunks; c++) {
+        selected.insert(selected.end(), chunkSelected[c].begin(), chunkSelected[c].end());
+    }
+    return selected;
+}
+
+// A node on the first shell around both the fully damaged region and all particles
+template <class real>
+static bool ifSurfaceNode(const DamageGridT<real>& grid, int id)
 {
+    return grid.label(DamageGrid::fullyDamagedChannel, id) == 2 && grid.label(DamageGrid::allParticlesChannel, id) == 2;
+}
 
-    cout << "Start extracting" << endl;
-
-    //*********Read fully damaged particles***********//
-    std::vector<Particle> fullyDamagedParticles;
-    std::map<int, int> fullyDamagedParticlesGridMap;
-    std::vector<Grid> fullyDamagedParticlesNodesVec;
-
-    readParticles(particlesRaw, &fullyDamagedParticles, true, param);
-    calDamageGradient(&fullyDamagedParticles, param, param.dx, &fullyDamagedParticlesGridMap, &fullyDamagedParticlesNodesVec);
-    setNodeValue(&fullyDamagedParticlesNodesVec, 1);
-    findBoundaryNodes(&fullyDamagedParticles, &fullyDamagedParticlesNodesVec, &fullyDamagedParticlesGridMap, param, 2); // This bounding box is used to generate boundary nodes
-    findBoundaryNodes(&fullyDamagedParticles, &fullyDamagedParticlesNodesVec, &fullyDamagedParticlesGridMap, param, 3); // This bounding box is used to generate clip surface mesh
-    //*********Read fully damaged particles***********//
-
-    //*********Read all particles***********//
-    std::vector<Particle> allParticles;
-    std::map<int, int> allParticlesGridMap;
-    std::vector<Grid> allParticlesNodesVec;
-
-    readParticles(particlesRaw, &allParticles, false, param);
-    calDamageGradient(&allParticles, param, param.dx, &allParticlesGridMap, &allParticlesNodesVec);
-    setNodeValue(&allParticlesNodesVec, 1);
-    findBoundaryNodes(&allParticles, &allParticlesNodesVec, &allParticlesGridMap, param, 2); // This bounding box is used to generate boundary nodes
-    findBoundaryNodes(&allParticles, &allParticlesNodesVec, &allParticlesGridMap, param, 3); // This bounding box is used to generate clip surface mesh
-    //*********Read all particles**********
-
-    // find boundary nodes
-    std::vector<int> allParticlesNodeBoundaryIndex; // store the index or ID of allParticles boundary nodes
-    for (int i = 0; i < allParticlesNodesVec.size(); i++) {
-        if (allParticlesNodesVec[i].Di == 2) {
-            int ID = calculateID(allParticlesNodesVec[i].posIndex[0], allParticlesNodesVec[i].posIndex[1], allParticlesNodesVec[i].posIndex[2], param.length, param.dx);
-            allParticlesNodeBoundaryIndex.push_back(ID);
+// A node of the first shell around the fully damaged region which is not on the first shell around all particles.
+// These nodes become boundary nodes unless they are isolated
+template <class real>
+static bool ifBoundaryNodeCandidate(const DamageGridT<real>& grid, int id)
+{
+    return grid.label(DamageGrid::fullyDamagedChannel, id) == 2 && grid.label(DamageGrid::allParticlesChannel, id) != 2;
+}
+
+// Append a Voronoi cell computed by voro++ to a tessellation, only its neighbours if "geometry" is false
+template <class real>
+static void storeVoronoiCell(voronoicell_neighbor* c, Eigen::Vector3d pos, bool geometry, VoronoiTessellation<real>* cells)
+{
+    typedef Eigen::Matrix<real, 3, 1> vector3;
+    std::vector<int> neighbour, verticesFace;
+    std::vector<double> vertices;
+    std::vector<double> normals;
+
+    (*cells).beginCell(pos);
+
+    (*c).neighbors(neighbour);
+    if (!geometry) {
+        for (int k = 0; k < neighbour.size(); k++) {
+            (*cells).addFace(neighbour[k]);
         }
+        return;
     }
 
-    //************find surface nodes//
-    std::vector<int> surfaceNodesID; // store surface nodes ID
-    std::vector<Eigen::Vector3i> surfaceNodesPosIndex; // store surface position index
-    std::vector<int> boundaryNodesIDNoClean; // store boundary nodes ID
-    std::vector<Eigen::Vector3i> boundaryNodesPosIndexNoClean; // store boundary position index
-    for (int i = 0; i < fullyDamagedParticlesNodesVec.size(); i++) {
-        if (fullyDamagedParticlesNodesVec[i].Di == 2) {
-            int ID = calculateID(fullyDamagedParticlesNodesVec[i].posIndex[0], fullyDamagedParticlesNodesVec[i].posIndex[1], fullyDamagedParticlesNodesVec[i].posIndex[2], param.length, param.dx);
-            if (count(allParticlesNodeBoundaryIndex.begin(), allParticlesNodeBoundaryIndex.end(), ID) == 0) {
-                boundaryNodesPosIndexNoClean.push_back(fullyDamagedParticlesNodesVec[i].posIndex);
-                boundaryNodesIDNoClean.push_back(ID);
-            }
+    (*c).vertices(pos[0], pos[1], pos[2], vertices);
+    for (int m = 0; m < vertices.size() / 3; m++) {
+        (*cells).addVertex(vector3((real)vertices[m * 3], (real)vertices[m * 3 + 1], (real)vertices[m * 3 + 2])); // voro++ works in double
+    }
 
-            //************find surface nodes//
-            if (count(allParticlesNodeBoundaryIndex.begin(), allParticlesNodeBoundaryIndex.end(), ID) != 0) {
-                int surfaceNodeID = calculateID(fullyDamagedParticlesNodesVec[i].posIndex[0], fullyDamagedParticlesNodesVec[i].posIndex[1], fullyDamagedParticlesNodesVec[i].posIndex[2], param.length, param.dx);
-                surfaceNodesID.push_back(surfaceNodeID);
-                surfaceNodesPosIndex.push_back(fullyDamagedParticlesNodesVec[i].posIndex);
-            }
-            //************find surface nodes//
+    // the face vertices come as the number of vertices of a face followed by its vertices, face by face
+    (*c).face_vertices(verticesFace);
+    (*c).normals(normals);
+    int start = 0;
+    for (int k = 0; k < neighbour.size(); k++) {
+        vector3 normal = vector3((real)normals[k * 3], (real)normals[k * 3 + 1], (real)normals[k * 3 + 2]);
+        (*cells).addFace(neighbour[k], normal, &verticesFace[start + 1], verticesFace[start]);
+        start += verticesFace[start] + 1;
+    }
+}
+
+// Append the neighbours of the cell of a seed whose six axis neighbours are seeds as well to a tessellation. All seeds
+// are lattice nodes, so the bisector planes of the six neighbours bound a cube of side dx and no other seed cuts it.
+// The bisectors of the diagonal seeds only touch the cube's edges and corners; voro++ may give them faces of zero area
+// there, which the cube cell leaves out, so its neighbours are those of voro++'s faces of positive area (see
+// checkCubeCell). The faces are ordered -x, +x, -y, +y, -z, +z. The neighbours of a cube cell are no farther apart than
+// dx, so it never owns a crack face and its geometry is never needed
+template <class real>
+static void storeCubeCell(const Eigen::Vector3i& posIndex, double dx, NodeHashMap* pointIndexFind, VoronoiTessellation<real>* cells)
+{
+    (*cells).beginCell(posIndex.cast<double>() * dx);
+
+    for (int f = 0; f < 6; f++) {
+        Eigen::Vector3i normal = { 0, 0, 0 };
+        normal[f / 2] = 2 * (f % 2) - 1;
+        (*cells).addFace((*pointIndexFind).find(posIndex + normal));
+    }
+}
+
+#ifndef NDEBUG
+// Compare a cube cell with the cell voro++ computes for the same seed: the faces of positive area must be the six faces
+// of side dx with the neighbours storeCubeCell gives them
+static void checkCubeCell(voronoicell_neighbor* c, const Eigen::Vector3i& posIndex, double dx, NodeHashMap* pointIndexFind)
+{
+    std::vector<int> neighbour, cubeNeighbour;
+    std::vector<double> areas;
+    (*c).neighbors(neighbour);
+    (*c).face_areas(areas);
+    for (int f = 0; f < 6; f++) {
+        Eigen::Vector3i normal = { 0, 0, 0 };
+        normal[f / 2] = 2 * (f % 2) - 1;
+        cubeNeighbour.push_back((*pointIndexFind).find(posIndex + normal));
+    }
+
+    std::vector<int> faceNeighbour;
+    for (int k = 0; k < neighbour.size(); k++) {
+        if (areas[k] > 1e-9 * dx * dx) {
+            ASSERT(std::abs(areas[k] - dx * dx) < 1e-9 * dx * dx);
+            faceNeighbour.push_back(neighbour[k]);
+        }
+    }
+    std::sort(faceNeighbour.begin(), faceNeighbour.end());
+    std::sort(cubeNeighbour.begin(), cubeNeighbour.end());
+    ASSERT(faceNeighbour == cubeNeighbour);
+}
+#endif
+
+// Mark the faces between two cells as compared, on both sides
+template <class real>
+static void markCompared(const VoronoiTessellation<real>& cells, int i, int j, std::vector<unsigned char>* faceCompared)
+{
+    for (int k = 0; k < cells.numFaces(i); k++) {
+        if (cells.neighbour(i, k) == j) {
+            (*faceCompared)[cells.firstFace(i) + k] = 1;
+        }
+    }
+    for (int k = 0; k < cells.numFaces(j); k++) {
+        if (cells.neighbour(j, k) == i) {
+            (*faceCompared)[cells.firstFace(j) + k] = 1;
         }
     }
+}
 
-    // clean isolate nodes and sharp nodes
-    std::vector<int> boundaryNodesID; // store boundary nodes ID
-    std::vector<Eigen::Vector3i> boundaryNodesPosIndex; // store boundary position index
-    for (int m = 0; m < boundaryNodesPosIndexNoClean.size(); m++) {
-        bool stopIsolate = false;
+// Extract the crack surface with the damage grid and the Voronoi geometry stored as "real"
+template <class real>
+static std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extractCrackSurfaceReal(std::vector<DamageParticleT<real>>* allParticles, struct parametersSim param)
+{
+    //*********Fully damaged and all particles***********//
+    // One transfer of all particles gives both regions: fully damaged particles carry damage 1 and the others 0, so the
+    // nodes with damage are the fully damaged region. Each region gets two shells: label 2 is used to generate boundary
+    // nodes and label 3 to generate the clip surface mesh
+    DamageGridT<real> grid;
+
+    calDamageGradient(allParticles, param, param.dx, &grid); // the damage gradients are not needed
+    setOccupancy(&grid);
+    grid.dilate(DamageGrid::fullyDamagedChannel, 2);
+    grid.dilate(DamageGrid::allParticlesChannel, 2);
+    smoothFullyDamaged(&grid, param);
+    //*********Fully damaged and all particles***********//
+
+    // find boundary nodes. Membership of a node in the shells is read from its labels, so every test is O(1) and the
+    // nodes are classified in parallel
+    std::vector<int> candidateIds = parallelSelect(grid.numNodes(), [&](int id) { return ifBoundaryNodeCandidate(grid, id); });
+
+    // clean isolate nodes and sharp nodes: a boundary node needs a boundary candidate among its axis neighbours
+    std::vector<int> boundaryIds = parallelSelect((int)candidateIds.size(), [&](int m) {
         for (int axis = 0; axis < 3; axis++) // three axis directions
         {
-            if (stopIsolate == false) {
-                for (int pn = 0; pn < 2; pn++) {
-                    if (stopIsolate == false) {
-                        Eigen::Vector3i normal = { 0, 0, 0 };
-                        normal[axis] = 2 * pn - 1;
-                        Eigen::Vector3i nodePosIndex = boundaryNodesPosIndexNoClean[m] + normal;
-                        int nodeID = calculateID(nodePosIndex[0], nodePosIndex[1], nodePosIndex[2], param.length, param.dx);
-                        if (count(boundaryNodesIDNoClean.begin(), boundaryNodesIDNoClean.end(), nodeID) != 0) {
-                            boundaryNodesID.push_back(boundaryNodesIDNoClean[m]);
-                            boundaryNodesPosIndex.push_back(boundaryNodesPosIndexNoClean[m]);
-                            stopIsolate = true;
-                        }
-                    }
+            for (int pn = 0; pn < 2; pn++) {
+                Eigen::Vector3i normal = { 0, 0, 0 };
+                normal[axis] = 2 * pn - 1;
+                int eid = grid.find(grid.posIndex(candidateIds[m]) + normal);
+                if (eid != -1 && ifBoundaryNodeCandidate(grid, eid)) {
+                    return true;
                 }
             }
         }
-    }
+        return false;
+    });
 
-    // define a std::map that can find the index of a point in the point vector
-    std::map<int, int> pointIndexFind;
-    for (int m = 0; m < boundaryNodesID.size(); m++) {
-        pointIndexFind[boundaryNodesID[m]] = m;
+    std::vector<Eigen::Vector3i> boundaryNodesPosIndex(boundaryIds.size()); // store boundary position index
+#pragma omp parallel for
+    for (int m = 0; m < boundaryIds.size(); m++) {
+        boundaryNodesPosIndex[m] = grid.posIndex(candidateIds[boundaryIds[m]]);
     }
 
-    ofstream outfile45("boundaryNodes.txt", ios::trunc);
+    // define a hash map that can find the index of a point in the point vector
+    NodeHashMap pointIndexFind;
+    pointIndexFind.reserve(boundaryNodesPosIndex.size());
     for (int m = 0; m < boundaryNodesPosIndex.size(); m++) {
-        outfile45 << m << " " << scientific << setprecision(8) << boundaryNodesPosIndex[m][0] * param.dx << " " << boundaryNodesPosIndex[m][1] * param.dx << " " << boundaryNodesPosIndex[m][2] * param.dx << endl;
+        pointIndexFind.insert(boundaryNodesPosIndex[m], m);
     }
-    outfile45.close();
 
-    cout << "The number of boundary nodes is " << boundaryNodesID.size() << endl;
+    cout << "The number of boundary nodes is " << boundaryNodesPosIndex.size() << endl;
 
-    // find critical nodes
-    std::vector<int> criticalNodeIndex;
+    // find critical nodes: the boundary nodes inside the cube of a surface node. Each boundary node searches its own
+    // cube for a surface node, which gives the same nodes. The hash map stores each critical node with its position in
+    // the order of the boundary nodes
     int criticalNodeVolumeLength = 1;
-    for (int m = 0; m < surfaceNodesPosIndex.size(); m++) {
-
+    std::vector<int> criticalIds = parallelSelect((int)boundaryNodesPosIndex.size(), [&](int m) {
         for (int i = -criticalNodeVolumeLength; i < criticalNodeVolumeLength + 1; i++) {
             for (int j = -criticalNodeVolumeLength; j < criticalNodeVolumeLength + 1; j++) {
                 for (int k = -criticalNodeVolumeLength; k < criticalNodeVolumeLength + 1; k++) {
                     Eigen::Vector3i increment = { i, j, k };
-                    Eigen::Vector3i nodePosIndex = surfaceNodesPosIndex[m] + increment;
-                    int ID = calculateID(nodePosIndex[0], nodePosIndex[1], nodePosIndex[2], param.length, param.dx);
-                    if (count(boundaryNodesID.begin(), boundaryNodesID.end(), ID) != 0) {
-                        if (count(criticalNodeIndex.begin(), criticalNodeIndex.end(), ID) == 0) {
-                            criticalNodeIndex.push_back(ID);
-                        }
+                    int eid = grid.find(boundaryNodesPosIndex[m] + increment);
+                    if (eid != -1 && ifSurfaceNode(grid, eid)) {
+                        return true;
                     }
                 }
             }
         }
+        return false;
+    });
+
+    NodeHashMap criticalNodes;
+    criticalNodes.reserve(criticalIds.size());
+    for (int c = 0; c < criticalIds.size(); c++) {
+        criticalNodes.insert(boundaryNodesPosIndex[criticalIds[c]], c);
     }
 
     cout << "Start voro++" << endl;
@@ -746,14 +701,14 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
     double z_min = 1.0E10, z_max = -1.0E10;
     int n_x = 10, n_y = 10, n_z = 10;
 
-    for (int m = 0; m < (*particlesRaw).size(); m++) {
-        x_min = std::min(x_min, (*particlesRaw)[m].pos[0]);
-        y_min = std::min(y_min, (*particlesRaw)[m].pos[1]);
-        z_min = std::min(z_min, (*particlesRaw)[m].pos[2]);
+    for (int m = 0; m < (*allParticles).size(); m++) {
+        x_min = std::min(x_min, (double)(*allParticles)[m].pos[0]);
+        y_min = std::min(y_min, (double)(*allParticles)[m].pos[1]);
+        z_min = std::min(z_min, (double)(*allParticles)[m].pos[2]);
 
-        x_max = std::max(x_max, (*particlesRaw)[m].pos[0]);
-        y_max = std::max(y_max, (*particlesRaw)[m].pos[1]);
-        z_max = std::max(z_max, (*particlesRaw)[m].pos[2]);
+        x_max = std::max(x_max, (double)(*allParticles)[m].pos[0]);
+        y_max = std::max(y_max, (double)(*allParticles)[m].pos[1]);
+        z_max = std::max(z_max, (double)(*allParticles)[m].pos[2]);
     }
     x_min = x_min - 4 * param.dx;
     x_max = x_max + 4 * param.dx;
@@ -762,84 +717,114 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
     z_min = z_min - 4 * param.dx;
     z_max = z_max + 4 * param.dx;
 
-    pre_container pcon(x_min, x_max, y_min, y_max, z_min, z_max, false, false, false);
-    // Import the particles from a file
-    pcon.import("boundaryNodes.txt");
-    pcon.guess_optimal(n_x, n_y, n_z);
-    container con(x_min, x_max, y_min, y_max, z_min, z_max, n_x, n_y, n_z, false, false, false, 8);
-    pcon.setup(con);
-
-    std::vector<Point> points;
-    for (int i = 0; i < boundaryNodesPosIndex.size(); i++) {
-        Eigen::Vector3d pos = { 0, 0, 0 }; // each point's position
-        std::vector<Eigen::Vector3d> verticsCoor; // vertices' coordinate
-        std::vector<std::vector<int>> verticesFace; // vertices of each face
-        std::vector<Eigen::Vector3d> surfaceNormal; // vertices' coordinate
-        std::vector<int> neighbour; // neighbour points that share common faces with this point
-        std::vector<int> neighbourCalculated; // neighbour points that have already find shared face
-        points.push_back(Point(-999, pos, 0, verticsCoor, 0, verticesFace, surfaceNormal, neighbour));
-    }
-
-    c_loop_all cl(con);
-    if (cl.start()) {
-
-        double x, y, z;
-        int index;
-        voronoicell_neighbor c;
-        std::vector<int> neighbour, verticesFace;
-        std::vector<double> vertices;
-        std::vector<double> normals;
-        do
-            if (con.compute_cell(c, cl)) {
-
-                int index = cl.pid();
-                points[index].index = index;
-
-                cl.pos(x, y, z);
-                points[index].pos = { x, y, z };
-
-                c.vertices(x, y, z, vertices);
-                points[index].numVertices = vertices.size() / 3;
-                for (int m = 0; m < vertices.size() / 3; m++) {
-                    Eigen::Vector3d vert = { vertices[m * 3], vertices[m * 3 + 1], vertices[m * 3 + 2] };
-                    points[index].verticsCoor.push_back(vert);
+    // size the container's blocks for the number of boundary nodes in the same way as pre_container::guess_optimal
+    int numSeeds = (int)boundaryNodesPosIndex.size();
+    double blockScale = pow(numSeeds / (voro::optimal_particles * (x_max - x_min) * (y_max - y_min) * (z_max - z_min)), 1 / 3.0);
+    n_x = int((x_max - x_min) * blockScale + 1);
+    n_y = int((y_max - y_min) * blockScale + 1);
+    n_z = int((z_max - z_min) * blockScale + 1);
+
+    // Seeds inside a regular part of the lattice get their cube cells directly, voro++ only computes the other cells
+    std::vector<unsigned char> cubeCell(numSeeds, 0);
+#pragma omp parallel for
+    for (int m = 0; m < numSeeds; m++) {
+        bool allNeighbours = true;
+        for (int f = 0; f < 6; f++) {
+            Eigen::Vector3i normal = { 0, 0, 0 };
+            normal[f / 2] = 2 * (f % 2) - 1;
+            allNeighbours = allNeighbours && pointIndexFind.contains(boundaryNodesPosIndex[m] + normal);
+        }
+        cubeCell[m] = allNeighbours ? 1 : 0;
+    }
+
+    double pi = 3.141592653;
+    double radius = param.dx * sqrt(3); // support radius of two points
+
+    // The faces are classified and the fragments are found with the neighbours of the cells alone, the geometry is only
+    // needed for the crack faces and the faces on the boundary of a fragment. A crack face joins two seeds farther apart
+    // than "radius", and two fragments only meet at crack faces, so only cells with such a face or a wall of the
+    // container can need their geometry. Their geometry is stored while the cells are computed, the other cells only
+    // store their neighbours.
+    // The cells are computed layer by layer of the container's blocks (along z), the layers are shared out among the
+    // threads. Cells next to the undamaged bulk reach across the domain, so a thread cannot work with the seeds of its
+    // layers and a thin ghost layer around them; every thread sets up its own container with all seeds instead. The
+    // containers are identical to a serial one, so each cell is computed exactly as in a serial run. Each thread appends
+    // its cells to tessellations of its own, which are gathered afterwards.
+    // A container takes 28 bytes per seed, up to twice that as its blocks grow, so the number of threads is limited to
+    // keep all containers together below maxContainerSeeds seeds (2 to 4 GB)
+    const int64_t maxContainerSeeds = int64_t(1) << 26;
+    int numThreads = std::max(1, std::min(omp_get_max_threads(), n_z));
+    numThreads = (int)std::max<int64_t>(1, std::min<int64_t>(numThreads, maxContainerSeeds / std::max(numSeeds, 1)));
+
+    VoronoiTessellation<real> cells; // the neighbours of all cells
+    VoronoiTessellation<real> geometry; // the geometry of the cells which may need it, the other cells are empty
+    {
+        std::vector<VoronoiTessellation<real>> threadCells(numThreads), threadGeometry(numThreads);
+        std::vector<std::pair<int, int>> cellSource(numSeeds, std::make_pair(-1, -1)); // tessellation and cell of each seed
+        std::vector<std::pair<int, int>> geometrySource(numSeeds, std::make_pair(-1, -1));
+#pragma omp parallel num_threads(numThreads)
+        {
+            int t = omp_get_thread_num();
+
+#pragma omp for schedule(static, 256)
+            for (int m = 0; m < numSeeds; m++) {
+                if (cubeCell[m] == 1) {
+                    storeCubeCell(boundaryNodesPosIndex[m], param.dx, &pointIndexFind, &threadCells[t]);
+                    cellSource[m] = std::make_pair(t, threadCells[t].numCells() - 1);
                 }
+            }
 
-                c.neighbors(neighbour);
-                points[index].neighbour = neighbour;
-                points[index].numFaces = neighbour.size();
+            container con(x_min, x_max, y_min, y_max, z_min, z_max, n_x, n_y, n_z, false, false, false, 8);
 
-                c.face_vertices(verticesFace);
-                int start = 1, end = verticesFace[0] + 1;
-                do {
-                    std::vector<int> faceVert;
-                    for (int m = start; m < end; m++) {
-                        faceVert.push_back(verticesFace[m]);
-                    }
-                    points[index].verticesFace.push_back(faceVert);
-                    start = end + 1;
-                    end += verticesFace[end] + 1;
-                } while (points[index].verticesFace.size() != neighbour.size());
-
-                c.normals(normals);
-                for (int m = 0; m < normals.size() / 3; m++) {
-                    Eigen::Vector3d normal = { normals[m * 3], normals[m * 3 + 1], normals[m * 3 + 2] };
-                    points[index].surfaceNormal.push_back(normal);
+            // the boundary nodes are the seeds, numbered by their position in boundaryNodesPosIndex
+            for (int m = 0; m < numSeeds; m++) {
+                Eigen::Vector3d seed = boundaryNodesPosIndex[m].cast<double>() * param.dx;
+                con.put(m, seed[0], seed[1], seed[2]);
+            }
+
+            voronoicell_neighbor c;
+            std::vector<int> neighbour;
+#pragma omp for schedule(dynamic, 1)
+            for (int layer = 0; layer < n_z; layer++) {
+                c_loop_subset cl(con);
+                cl.setup_intbox(0, n_x - 1, 0, n_y - 1, layer, layer);
+                if (cl.start()) {
+                    do {
+                        if (cubeCell[cl.pid()] == 0 && con.compute_cell(c, cl)) {
+                            double x, y, z;
+                            cl.pos(x, y, z);
+                            Eigen::Vector3d pos(x, y, z);
+                            storeVoronoiCell(&c, pos, false, &threadCells[t]);
+                            cellSource[cl.pid()] = std::make_pair(t, threadCells[t].numCells() - 1);
+
+                            // the same test as the classification of the faces, with the same seed positions
+                            bool mayNeedGeometry = false;
+                            c.neighbors(neighbour);
+                            for (int k = 0; k < neighbour.size(); k++) {
+                                mayNeedGeometry = mayNeedGeometry || neighbour[k] < 0 || (pos - boundaryNodesPosIndex[neighbour[k]].cast<double>() * param.dx).norm() > radius;
+                            }
+                            if (mayNeedGeometry) {
+                                storeVoronoiCell(&c, pos, true, &threadGeometry[t]);
+                                geometrySource[cl.pid()] = std::make_pair(t, threadGeometry[t].numCells() - 1);
+                            }
+                        }
+#ifndef NDEBUG
+                        // debug builds compare a sample of the cube cells with voro++
+                        if (cubeCell[cl.pid()] == 1 && cl.pid() % 64 == 0 && con.compute_cell(c, cl)) {
+                            checkCubeCell(&c, boundaryNodesPosIndex[cl.pid()], param.dx, &pointIndexFind);
+                        }
+#endif
+                    } while (cl.inc());
                 }
             }
-        while (cl.inc());
+        }
+
+        cells.gather(threadCells, cellSource);
+        geometry.gather(threadGeometry, geometrySource);
     }
 
     cout << "Voro++ finished" << endl;
 
-    //***********Read all particles and calculate the damage gradient*************//
-    std::vector<Particle> particles;
-    std::map<int, int> gridMap;
-    std::vector<Grid> nodesVec;
-    readParticlesAndCalGradient(&fullyDamagedParticlesNodesVec, &particles, param, &gridMap, &nodesVec);
-
-    double pi = 3.141592653;
-    double radius = param.dx * sqrt(3); // support radius of two points
     //radius = 0;
 
     std::vector<Eigen::Vector3d> verticesTmp; // vertex index
@@ -847,62 +832,57 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
 
     cout << "Start extracting interior faces" << endl;
 
-    std::vector<set<int>> sharedFace(points.size()); // store the point index which shares a crack surface with the other point
+    std::vector<std::pair<int, int>> crackFaces; // the crack faces as cell and face number, in the order they are found
+    std::vector<set<int>> sharedFace(numSeeds); // store the point index which shares a crack surface with the other point
+    NeighbourLists neighbourSameSide(numSeeds); // neighbour points that are on the same side with each point
+    NeighbourLists neighbourOtherSide(numSeeds); // neighbour points that are on the other side with each point
+    std::vector<unsigned char> faceCompared(cells.numFaces(), 0); // if the two points of a face have already been compared
 
     // find faces that are in the interior and store neighbour information
-    for (int i = 0; i < points.size(); i++) {
-        Eigen::Vector3d pos = points[i].pos;
-        if (ifCriticalNode(pos, param, &criticalNodeIndex) == false) {
-            for (int k = 0; k < points[i].neighbour.size(); k++) {
-                int neighbourIndex = points[i].neighbour[k];
+    for (int i = 0; i < numSeeds; i++) {
+        Eigen::Vector3d pos = cells.pos(i);
+        if (ifCriticalNode(pos, param, &criticalNodes) == false) {
+            for (int k = 0; k < cells.numFaces(i); k++) {
+                int neighbourIndex = cells.neighbour(i, k);
                 if (neighbourIndex > 0) // remove bounding box faces
                 {
 
-                    Eigen::Vector3d posNeig = points[neighbourIndex].pos;
+                    Eigen::Vector3d posNeig = cells.pos(neighbourIndex);
                     Eigen::Vector3d posDiff = pos - posNeig;
                     double distancePair = posDiff.norm();
 
-                    if (ifCriticalNode(posNeig, param, &criticalNodeIndex) == false) {
-                        if (count(points[i].neighbourCalculated.begin(), points[i].neighbourCalculated.end(), neighbourIndex) == 0) // if these two neighbours have not yet been compared
+                    if (ifCriticalNode(posNeig, param, &criticalNodes) == false) {
+                        if (faceCompared[cells.firstFace(i) + k] == 0) // if these two neighbours have not yet been compared
                         {
 
                             if (distancePair > radius) // if their distance is larger than the threshold
                             {
-                                double existInCrack = ifFullyDamaged((pos + posNeig) / 2.0, param, &gridMap, &nodesVec);
+                                double existInCrack = ifFullyDamaged((pos + posNeig) / 2.0, param, &grid);
                                 if (existInCrack >= 1.0) // if the middle point is located in the crack area
                                 {
 
-                                    std::vector<int> faceVerteice;
-                                    for (int ver = 0; ver < points[i].verticesFace[k].size(); ver++) {
-                                        int indexVertex = points[i].verticesFace[k][ver];
-                                        Vector3d vertex = points[i].verticsCoor[indexVertex];
-                                        int vertexIndex = findIndexVertex(vertex, &verticesTmp);
-                                        faceVerteice.push_back(vertexIndex);
-                                    }
-                                    facesTmp.push_back(faceVerteice);
+                                    crackFaces.push_back(std::make_pair(i, k));
 
                                     sharedFace[i].insert(neighbourIndex);
                                     sharedFace[neighbourIndex].insert(i);
 
-                                    points[i].neighbourOtherSide.push_back(neighbourIndex);
-                                    points[neighbourIndex].neighbourOtherSide.push_back(i);
+                                    neighbourOtherSide.add(i, neighbourIndex);
+                                    neighbourOtherSide.add(neighbourIndex, i);
 
                                 } else {
-                                    points[i].neighbourSameSide.push_back(neighbourIndex);
-                                    points[neighbourIndex].neighbourSameSide.push_back(i);
+                                    neighbourSameSide.add(i, neighbourIndex);
+                                    neighbourSameSide.add(neighbourIndex, i);
                                 }
 
                                 // store computation information.
-                                points[i].neighbourCalculated.push_back(neighbourIndex);
-                                points[neighbourIndex].neighbourCalculated.push_back(i);
+                                markCompared(cells, i, neighbourIndex, &faceCompared);
 
                             } else {
-                                points[i].neighbourSameSide.push_back(neighbourIndex);
-                                points[neighbourIndex].neighbourSameSide.push_back(i);
+                                neighbourSameSide.add(i, neighbourIndex);
+                                neighbourSameSide.add(neighbourIndex, i);
 
                                 // store computation information.
-                                points[i].neighbourCalculated.push_back(neighbourIndex);
-                                points[neighbourIndex].neighbourCalculated.push_back(i);
+                                markCompared(cells, i, neighbourIndex, &faceCompared);
                             }
                         }
                     }
@@ -913,59 +893,50 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
 
     cout << "Start extracting boundary faces" << endl;
     // find faces that are in the interior and store neighbour information
-    for (int i = 0; i < points.size(); i++) {
-        Eigen::Vector3d pos = points[i].pos;
+    for (int i = 0; i < numSeeds; i++) {
+        Eigen::Vector3d pos = cells.pos(i);
 
-        if (ifCriticalNode(pos, param, &criticalNodeIndex) == false) {
-            for (int k = 0; k < points[i].neighbour.size(); k++) {
-                int neighbourIndex = points[i].neighbour[k];
+        if (ifCriticalNode(pos, param, &criticalNodes) == false) {
+            for (int k = 0; k < cells.numFaces(i); k++) {
+                int neighbourIndex = cells.neighbour(i, k);
                 if (neighbourIndex > 0) // remove bounding box faces
                 {
 
-                    Eigen::Vector3d posNeig = points[neighbourIndex].pos;
+                    Eigen::Vector3d posNeig = cells.pos(neighbourIndex);
                     Eigen::Vector3d posDiff = pos - posNeig;
                     double distancePair = posDiff.norm();
 
-                    if (ifCriticalNode(posNeig, param, &criticalNodeIndex) == true) {
-                        if (count(points[i].neighbourCalculated.begin(), points[i].neighbourCalculated.end(), neighbourIndex) == 0) // if these two neighbours have not yet been compared
+                    if (ifCriticalNode(posNeig, param, &criticalNodes) == true) {
+                        if (faceCompared[cells.firstFace(i) + k] == 0) // if these two neighbours have not yet been compared
                         {
 
                             if (distancePair > radius) // if their distance is larger than the threshold
                             {
-                                bool twoSide1 = ifTwoSides(i, neighbourIndex, &points, &boundaryNodesID, &boundaryNodesPosIndex, &pointIndexFind, param, &criticalNodeIndex);
+                                bool twoSide1 = ifTwoSides(i, neighbourIndex, &neighbourSameSide, &neighbourOtherSide, &boundaryNodesPosIndex, &pointIndexFind, param, &criticalNodes);
 
                                 //twoSide1 = true;
                                 if (twoSide1 == true) {
-                                    std::vector<int> faceVerteice;
-                                    for (int ver = 0; ver < points[i].verticesFace[k].size(); ver++) {
-                                        int indexVertex = points[i].verticesFace[k][ver];
-                                        Vector3d vertex = points[i].verticsCoor[indexVertex];
-                                        int vertexIndex = findIndexVertex(vertex, &verticesTmp);
-                                        faceVerteice.push_back(vertexIndex);
-                                    }
-                                    facesTmp.push_back(faceVerteice);
+                                    crackFaces.push_back(std::make_pair(i, k));
 
                                     sharedFace[i].insert(neighbourIndex);
                                     sharedFace[neighbourIndex].insert(i);
 
-                                    points[i].neighbourOtherSide.push_back(neighbourIndex);
-                                    points[neighbourIndex].neighbourOtherSide.push_back(i);
+                                    neighbourOtherSide.add(i, neighbourIndex);
+                                    neighbourOtherSide.add(neighbourIndex, i);
                                 } else {
-                                    points[i].neighbourSameSide.push_back(neighbourIndex);
-                                    points[neighbourIndex].neighbourSameSide.push_back(i);
+                                    neighbourSameSide.add(i, neighbourIndex);
+                                    neighbourSameSide.add(neighbourIndex, i);
                                 }
 
                                 // store computation information.
-                                points[i].neighbourCalculated.push_back(neighbourIndex);
-                                points[neighbourIndex].neighbourCalculated.push_back(i);
+                                markCompared(cells, i, neighbourIndex, &faceCompared);
 
                             } else {
-                                points[i].neighbourSameSide.push_back(neighbourIndex);
-                                points[neighbourIndex].neighbourSameSide.push_back(i);
+                                neighbourSameSide.add(i, neighbourIndex);
+                                neighbourSameSide.add(neighbourIndex, i);
 
                                 // store computation information.
-                                points[i].neighbourCalculated.push_back(neighbourIndex);
-                                points[neighbourIndex].neighbourCalculated.push_back(i);
+                                markCompared(cells, i, neighbourIndex, &faceCompared);
                             }
                         }
                     }
@@ -975,45 +946,37 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
     }
 
     // find faces that defined by critical point
-    for (int i = 0; i < points.size(); i++) {
+    for (int i = 0; i < numSeeds; i++) {
 
-        Eigen::Vector3d pos = points[i].pos;
-        if (ifCriticalNode(pos, param, &criticalNodeIndex) == true) {
+        Eigen::Vector3d pos = cells.pos(i);
+        if (ifCriticalNode(pos, param, &criticalNodes) == true) {
 
-            for (int k = 0; k < points[i].neighbour.size(); k++) {
-                int neighbourIndex = points[i].neighbour[k];
+            for (int k = 0; k < cells.numFaces(i); k++) {
+                int neighbourIndex = cells.neighbour(i, k);
                 if (neighbourIndex > 0) // remove bounding box faces
                 {
-                    Eigen::Vector3d posNeig = points[neighbourIndex].pos;
+                    Eigen::Vector3d posNeig = cells.pos(neighbourIndex);
                     Eigen::Vector3d posDiff = pos - posNeig;
                     double distancePair = posDiff.norm();
 
-                    if (count(points[i].neighbourCalculated.begin(), points[i].neighbourCalculated.end(), neighbourIndex) == 0) // if these two neighbours have not yet been compared
+                    if (faceCompared[cells.firstFace(i) + k] == 0) // if these two neighbours have not yet been compared
                     {
 
                         if (distancePair > radius) // if their distance is larger than the threshold
                         {
 
-                            bool twoSide1 = ifTwoSides(i, neighbourIndex, &points, &boundaryNodesID, &boundaryNodesPosIndex, &pointIndexFind, param, &criticalNodeIndex);
+                            bool twoSide1 = ifTwoSides(i, neighbourIndex, &neighbourSameSide, &neighbourOtherSide, &boundaryNodesPosIndex, &pointIndexFind, param, &criticalNodes);
 
                             if (twoSide1 == true) {
 
-                                std::vector<int> faceVerteice;
-                                for (int ver = 0; ver < points[i].verticesFace[k].size(); ver++) {
-                                    int indexVertex = points[i].verticesFace[k][ver];
-                                    Vector3d vertex = points[i].verticsCoor[indexVertex];
-                                    int vertexIndex = findIndexVertex(vertex, &verticesTmp);
-                                    faceVerteice.push_back(vertexIndex);
-                                }
-                                facesTmp.push_back(faceVerteice);
+                                crackFaces.push_back(std::make_pair(i, k));
 
                                 sharedFace[i].insert(neighbourIndex);
                                 sharedFace[neighbourIndex].insert(i);
                             }
 
                             // store computation information.
-                            points[i].neighbourCalculated.push_back(neighbourIndex);
-                            points[neighbourIndex].neighbourCalculated.push_back(i);
+                            markCompared(cells, i, neighbourIndex, &faceCompared);
                         }
                     }
                 }
@@ -1025,7 +988,7 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
     // calculate all fragments
     ////////////////////////////////
     std::set<int> remainingPoints;
-    for (int i = 0; i < points.size(); i++) {
+    for (int i = 0; i < numSeeds; i++) {
         remainingPoints.insert(i);
     }
 
@@ -1044,8 +1007,8 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
             for (int i = start; i < start + countLayer; i++) // parse each candidate
             {
                 int currentPoint = fragment[i];
-                for (int j = 0; j < points[currentPoint].neighbour.size(); j++) {
-                    int candPoint = points[currentPoint].neighbour[j];
+                for (int j = 0; j < cells.numFaces(currentPoint); j++) {
+                    int candPoint = cells.neighbour(currentPoint, j);
                     if (candPoint >= 0) {
                         if (sharedFace[currentPoint].find(candPoint) == sharedFace[currentPoint].end()) {
                             if (std::find(fragment.begin(), fragment.end(), candPoint) == fragment.end()) {
@@ -1075,8 +1038,8 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
         std::vector<int> fragment = allFragments[i];
         bool interior = true;
         for (int j = 0; j < fragment.size(); j++) {
-            for (int h = 0; h < points[fragment[j]].neighbour.size(); h++) {
-                int neigPoint = points[fragment[j]].neighbour[h];
+            for (int h = 0; h < cells.numFaces(fragment[j]); h++) {
+                int neigPoint = cells.neighbour(fragment[j], h);
                 if (neigPoint < 0) {
                     interior = false;
                     break;
@@ -1106,8 +1069,8 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
             int surroundPoint = -99; // surrounding neighbour point of this interior volume
             for (int k = 0; k < allFragments[*it].size(); k++) {
                 int seedPoint = allFragments[*it][k];
-                for (int i = 0; i < points[seedPoint].neighbour.size(); i++) {
-                    int neigPoint = points[seedPoint].neighbour[i];
+                for (int i = 0; i < cells.numFaces(seedPoint); i++) {
+                    int neigPoint = cells.neighbour(seedPoint, i);
                     if (sharedFace[seedPoint].find(neigPoint) != sharedFace[seedPoint].end()) {
                         surroundPoint = neigPoint;
                         break;
@@ -1155,6 +1118,48 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
 
     std::cout << "Number of final fragments is =" << allFragmentsRemoveInterior.size() << endl;
 
+    // the cells which need their geometry: the owners of the crack faces and the cells with a face on the boundary of
+    // their fragment
+    std::vector<unsigned char> needGeometry(numSeeds, 0);
+    for (int f = 0; f < crackFaces.size(); f++) {
+        needGeometry[crackFaces[f].first] = 1;
+    }
+    std::vector<int> fragmentMark(numSeeds, -1); // the last fragment a point was found in
+    for (int i = 0; i < allFragmentsRemoveInterior.size(); i++) {
+        const std::vector<int>& fragment = allFragmentsRemoveInterior[i];
+        for (int k = 0; k < fragment.size(); k++) {
+            fragmentMark[fragment[k]] = i;
+        }
+        for (int k = 0; k < fragment.size(); k++) {
+            for (int h = 0; h < cells.numFaces(fragment[k]); h++) {
+                int opponentPoint = cells.neighbour(fragment[k], h);
+                if (opponentPoint < 0 || fragmentMark[opponentPoint] != i) {
+                    needGeometry[fragment[k]] = 1;
+                }
+            }
+        }
+    }
+
+    int numWithGeometry = 0;
+    for (int i = 0; i < numSeeds; i++) {
+        ASSERT(needGeometry[i] == 0 || geometry.numFaces(i) == cells.numFaces(i));
+        numWithGeometry += geometry.numFaces(i) > 0 ? 1 : 0;
+    }
+    std::cout << "The number of Voronoi cells with geometry is " << numWithGeometry << ", " << std::count(needGeometry.begin(), needGeometry.end(), 1) << " of them are needed" << endl;
+
+    // the vertices of the crack faces
+    for (int f = 0; f < crackFaces.size(); f++) {
+        int i = crackFaces[f].first, k = crackFaces[f].second;
+        std::vector<int> faceVerteice;
+        for (int ver = 0; ver < geometry.faceVertices(i, k).size(); ver++) {
+            int indexVertex = geometry.faceVertices(i, k)[ver];
+            Vector3d vertex = geometry.vertex(i, indexVertex).template cast<double>();
+            int vertexIndex = findIndexVertex(vertex, &verticesTmp);
+            faceVerteice.push_back(vertexIndex);
+        }
+        facesTmp.push_back(faceVerteice);
+    }
+
     // remove duplicated vertices
     std::vector<meshObjFormat> allFragmentsObj;
     for (int i = 0; i < allFragmentsRemoveInterior.size(); i++) {
@@ -1166,12 +1171,12 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
             // find faces of each voronoi cell
             std::set<int> voroCellVertices;
             std::vector<std::vector<int>> voroCellFaces;
-            for (int h = 0; h < points[fragment[k]].verticesFace.size(); h++) {
-                int opponentPoint = points[fragment[k]].neighbour[h];
+            for (int h = 0; h < cells.numFaces(fragment[k]); h++) {
+                int opponentPoint = cells.neighbour(fragment[k], h);
                 if (std::find(fragment.begin(), fragment.end(), opponentPoint) == fragment.end()) {
-                    voroCellFaces.push_back(points[fragment[k]].verticesFace[h]);
-                    for (int f = 0; f < points[fragment[k]].verticesFace[h].size(); f++) {
-                        voroCellVertices.insert(points[fragment[k]].verticesFace[h][f]);
+                    voroCellFaces.push_back(std::vector<int>(geometry.faceVertices(fragment[k], h).begin(), geometry.faceVertices(fragment[k], h).end()));
+                    for (int f = 0; f < geometry.faceVertices(fragment[k], h).size(); f++) {
+                        voroCellVertices.insert(geometry.faceVertices(fragment[k], h)[f]);
                     }
                 }
             }
@@ -1180,7 +1185,7 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
             std::map<int, int> verticesMapping;
             std::set<int>::iterator it;
             for (it = voroCellVertices.begin(); it != voroCellVertices.end(); ++it) {
-                Eigen::Vector3d candiVert = points[fragment[k]].verticsCoor[*it];
+                Eigen::Vector3d candiVert = geometry.vertex(fragment[k], *it).template cast<double>();
 
                 if (verticesEachFrag.size() == 0) {
                     verticesMapping[*it] = 0;
@@ -1231,8 +1236,8 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
 
         for (int k = 0; k < fragment.size(); k++) {
             // find faces of each voronoi cell
-            for (int h = 0; h < points[fragment[k]].verticesFace.size(); h++) {
-                int opponentPoint = points[fragment[k]].neighbour[h];
+            for (int h = 0; h < cells.numFaces(fragment[k]); h++) {
+                int opponentPoint = cells.neighbour(fragment[k], h);
                 if (opponentPoint >= 0 && std::find(fragment.begin(), fragment.end(), opponentPoint) == fragment.end()) {
                     std::string facePositive = std::to_string(fragment[k]) + "#" + std::to_string(opponentPoint);
                     std::string faceNegative = std::to_string(opponentPoint) + "#" + std::to_string(fragment[k]);
@@ -1243,9 +1248,9 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
                         int numOfVert = (int)vertices.size();
                         std::vector<int> face;
                         int co = 0;
-                        for (int f = 0; f < points[fragment[k]].verticesFace[h].size(); f++) {
-                            int vertIndex = points[fragment[k]].verticesFace[h][f];
-                            Eigen::Vector3d vertPos = points[fragment[k]].verticsCoor[vertIndex];
+                        for (int f = 0; f < geometry.faceVertices(fragment[k], h).size(); f++) {
+                            int vertIndex = geometry.faceVertices(fragment[k], h)[f];
+                            Eigen::Vector3d vertPos = geometry.vertex(fragment[k], vertIndex).template cast<double>();
 
                             int vertIndexVertices = -999;
                             for (int fg = 0; fg < vertices.size(); fg++) {
@@ -1286,6 +1291,30 @@ std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extra
     return resultReturn;
 }
 
+// Extract the crack surface
+std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> extractCrackSurface(std::vector<DamageParticle>* allParticles, struct parametersSim param)
+{
+
+    cout << "Start extracting (" << weightKernelName() << " weight kernel, " << (param.singlePrecision ? "single" : "double") << " precision)" << endl;
+
+    if (param.mortonSort) {
+        mortonSortParticles(allParticles, param.dx);
+    }
+
+    if (!param.singlePrecision) {
+        return extractCrackSurfaceReal(allParticles, param);
+    }
+
+    // convert the particles once, so that every later pass reads half the data
+    int numParticles = (int)(*allParticles).size();
+    std::vector<DamageParticleF> particlesF(numParticles, DamageParticleF(Eigen::Vector3f::Zero(), 0));
+#pragma omp parallel for
+    for (int m = 0; m < numParticles; m++) {
+        particlesF[m] = DamageParticleF((*allParticles)[m].pos.cast<float>(), (float)(*allParticles)[m].Dp);
+    }
+    return extractCrackSurfaceReal(&particlesF, param);
+}
+
 ////////////////////////////////
 // cut objects with ftetwild
 ////////////////////////////////
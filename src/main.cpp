@@ -1,9 +1,11 @@
 
 #include "crackExtraction/extractCrack.h"
 #include "crackExtraction/object.h"
+#include "crackExtraction/particleIO.h"
 #include "crackExtraction/utils.h"
 
 #include <igl/decimate.h>
+#include <sstream>
 #include <thread>
 
 // find the surface mesh from a vdb grid
@@ -62,48 +64,42 @@ void getSurfaceMeshFromVdbGrid(openvdb::FloatGrid::Ptr bareMeshVdbGridPtr, meshO
 }
 
 // the input particles may locate in the negative domain. This function projects them to the positive domain
-void preprocessing(std::string crackFilePath, std::string cutObjectFilePath, parametersSim* parameters, std::vector<Particle>* particleVec, meshObjFormat* objectMesh)
+void preprocessing(std::string crackFilePath, std::string cutObjectFilePath, parametersSim* parameters, particleSets* particles, meshObjFormat* objectMesh)
 {
-    // std::string path = "fixed.txt";
-    // std::ofstream outfile2(path, std::ios::trunc);
-
     // project damaged particles to the positive domain
-    // read damaged particles
-    std::ifstream inf;
-    inf.open(crackFilePath);
-    std::string sline;
-    std::string s0, s1, s2, s3;
-    while (getline(inf, sline)) {
-
-        std::istringstream sin(sline);
-        sin >> s0 >> s1 >> s2 >> s3;
-        Eigen::Vector3d ipos = { atof(s0.c_str()), atof(s1.c_str()), atof(s2.c_str()) };
-        Eigen::Vector3d ivel = { 0, 0, 0 };
-        double iDp = atof(s3.c_str());
-        (*particleVec).push_back(Particle(ipos, ivel, 0, 0, iDp));
-
-        //outfile2 << std::scientific << std::setprecision(3)<< ipos[0]<<" "<< ipos[1]<<" "<< ipos[2]<<" "<< iDp<<std::endl;
+    // read damaged particles and mark the fully damaged ones
+    if (!ingestParticles(crackFilePath, (*parameters).damageThreshold, particles) || (*particles).all.size() == 0) {
+        fprintf(stderr, "error: failed to read particles from %s\n", crackFilePath.c_str());
+        std::exit(1);
     }
-    //outfile2.close();
-
-    double xmin = (*particleVec)[0].pos[0], xmax = (*particleVec)[0].pos[0], ymin = (*particleVec)[0].pos[1], ymax = (*particleVec)[0].pos[1], zmin = (*particleVec)[0].pos[2], zmax = (*particleVec)[0].pos[2];
-    for (int km = 0; km < (*particleVec).size(); km++) {
-        Eigen::Vector3d ipos = (*particleVec)[km].pos;
-        xmin = std::min(xmin, ipos[0]);
-        xmax = std::max(xmax, ipos[0]);
-        ymin = std::min(ymin, ipos[1]);
-        ymax = std::max(ymax, ipos[1]);
-        zmin = std::min(zmin, ipos[2]);
-        zmax = std::max(zmax, ipos[2]);
+
+    std::cout << "Read " << (*particles).all.size() << " particles, " << (*particles).numFullyDamaged << " of them fully damaged. Damage histogram over [0, 1]:";
+    for (int b = 0; b < (int)(*particles).damageHistogram.size(); b++) {
+        std::cout << " " << (*particles).damageHistogram[b];
     }
-    Eigen::Vector3d minCoordinate = { xmin - 10 * (*parameters).dx, ymin - 10 * (*parameters).dx, zmin - 10 * (*parameters).dx };
-    for (int km = 0; km < (*particleVec).size(); km++) {
-        (*particleVec)[km].pos = (*particleVec)[km].pos - minCoordinate;
+    std::cout << std::endl;
+
+    if ((*particles).dx != 0 && (*particles).dx != (*parameters).dx) {
+        std::cout << "Note: the particle file suggests a medial surface resolution of " << (*particles).dx << std::endl;
     }
-    Eigen::Vector3d length = { xmax - xmin + 20 * (*parameters).dx, ymax - ymin + 20 * (*parameters).dx, zmax - zmin + 20 * (*parameters).dx };
+
+    // the bounding box is computed while the particles are parsed or read from the header of binary frames
+    Eigen::Vector3d minCoordinate = (*particles).minCoordinate - Eigen::Vector3d::Constant(10 * (*parameters).dx);
+    Eigen::Vector3d length = (*particles).maxCoordinate - (*particles).minCoordinate + Eigen::Vector3d::Constant(20 * (*parameters).dx);
     (*parameters).length = length;
     (*parameters).minCoordinate = minCoordinate;
 
+    // grid nodes are identified by their packed coordinates, see NodeHashMap::key
+    if (length.maxCoeff() / (*parameters).dx + 1 >= NodeHashMap::coordinateLimit) {
+        fprintf(stderr, "error: the domain spans %g nodes along an axis, at most %d are supported; increase dx\n", length.maxCoeff() / (*parameters).dx, NodeHashMap::coordinateLimit - 1);
+        std::exit(1);
+    }
+
+#pragma omp parallel for
+    for (int km = 0; km < (int)(*particles).all.size(); km++) {
+        (*particles).all[km].pos -= minCoordinate;
+    }
+
     Eigen::MatrixXd V;
     Eigen::MatrixXi F;
     bool success = igl::readOBJ(cutObjectFilePath, V, F);
@@ -150,6 +146,33 @@ void postprocessing(parametersSim* parameters, std::tuple<bool, meshObjFormat, m
     }
 }
 
+// Read the optional switches, one keyword per line after the six fixed lines of the config file
+void readOptions(const std::vector<std::string>& inputPara, parametersSim* parameters)
+{
+    for (int i = 6; i < inputPara.size(); i++) {
+        std::string option;
+        std::istringstream(inputPara[i]) >> option;
+        if (option.empty()) {
+            continue;
+        }
+
+        if (option == "DETERMINISTIC") {
+            (*parameters).deterministic = true;
+        } else if (option == "MORTON_SORT") {
+            (*parameters).mortonSort = true;
+        } else if (option == "LINEAR_KERNEL") {
+            (*parameters).kernel = linearInterpolation;
+        } else if (option == "CUBIC_KERNEL") {
+            (*parameters).kernel = cubicInterpolation;
+        } else if (option == "FLOAT32") {
+            (*parameters).singlePrecision = true;
+        } else {
+            fprintf(stderr, "error: unknown option \"%s\" in the config file.\n", option.c_str());
+            std::exit(1);
+        }
+    }
+}
+
 int main(int argc, char* argv[])
 {
     if (argc != 2) {
@@ -174,13 +197,14 @@ int main(int argc, char* argv[])
     parameters.vdbVoxelSize = std::stod(inputPara[5]);
     std::string crackFilePath = inputPara[0] + "/" + inputPara[1];
     std::string cutObjectFilePath = inputPara[0] + "/" + inputPara[2];
-    std::vector<Particle> particleVec;
+    readOptions(inputPara, &parameters);
+    particleSets particles;
     meshObjFormat objectMesh;
 
     // extract the crack surface
-    preprocessing(crackFilePath, cutObjectFilePath, &parameters, &particleVec, &objectMesh);
+    preprocessing(crackFilePath, cutObjectFilePath, &parameters, &particles, &objectMesh);
 
-    std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> result = extractCrackSurface(&particleVec, parameters);
+    std::tuple<bool, meshObjFormat, meshObjFormat, std::vector<meshObjFormat>> result = extractCrackSurface(&particles.all, parameters);
 
     if (std::get<0>(result) == false) {
         std::cout << "No crack found!" << std::endl;
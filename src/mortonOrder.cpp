@@ -0,0 +1,98 @@
+#include "crackExtraction/mortonOrder.h"
+
+#include <algorithm>
+#include <omp.h>
+
+// Stable order of the codes in increasing value
+void sortCodes(const std::vector<uint64_t>& codes, std::vector<int>* order)
+{
+    const int digitBits = 8;
+    const int numDigits = 1 << digitBits;
+    int n = (int)codes.size();
+
+    // bits used by any code, digits above them are all zero and need no pass
+    uint64_t usedBits = 0;
+#pragma omp parallel for reduction(| : usedBits)
+    for (int i = 0; i < n; i++) {
+        usedBits |= codes[i];
+    }
+    int numPasses = 0;
+    while (numPasses < 64 / digitBits && (usedBits >> (numPasses * digitBits)) != 0) {
+        numPasses += 1;
+    }
+
+    std::vector<uint64_t> keys(codes), keysNext(n);
+    std::vector<int> values(n), valuesNext(n);
+    for (int i = 0; i < n; i++) {
+        values[i] = i;
+    }
+
+    // each chunk of consecutive keys is counted and scattered by one thread, which keeps the sort stable
+    int numChunks = std::max(1, std::min(omp_get_max_threads(), n / 65536));
+    std::vector<int> chunkBegin(numChunks + 1);
+    for (int c = 0; c <= numChunks; c++) {
+        chunkBegin[c] = (int)((int64_t)n * c / numChunks);
+    }
+    std::vector<int> offset(numChunks * numDigits);
+
+    for (int pass = 0; pass < numPasses; pass++) {
+        int shift = pass * digitBits;
+
+        std::fill(offset.begin(), offset.end(), 0);
+#pragma omp parallel for schedule(static, 1)
+        for (int c = 0; c < numChunks; c++) {
+            int* count = &offset[c * numDigits];
+            for (int i = chunkBegin[c]; i < chunkBegin[c + 1]; i++) {
+                count[(keys[i] >> shift) & (numDigits - 1)] += 1;
+            }
+        }
+
+        // first position of each digit in each chunk: digit by digit, chunk by chunk
+        int sum = 0;
+        for (int d = 0; d < numDigits; d++) {
+            for (int c = 0; c < numChunks; c++) {
+                int count = offset[c * numDigits + d];
+                offset[c * numDigits + d] = sum;
+                sum += count;
+            }
+        }
+
+#pragma omp parallel for schedule(static, 1)
+        for (int c = 0; c < numChunks; c++) {
+            int* position = &offset[c * numDigits];
+            for (int i = chunkBegin[c]; i < chunkBegin[c + 1]; i++) {
+                int p = position[(keys[i] >> shift) & (numDigits - 1)]++;
+                keysNext[p] = keys[i];
+                valuesNext[p] = values[i];
+            }
+        }
+        keys.swap(keysNext);
+        values.swap(valuesNext);
+    }
+
+    (*order).swap(values);
+}
+
+// Sort particles by the Morton code of the grid cell containing them
+void mortonSortParticles(std::vector<DamageParticle>* particles, double dx)
+{
+    int n = (int)particles->size();
+    if (n == 0) {
+        return;
+    }
+
+    // the cell is the particle's ppIndex, computed as in calWeight
+    std::vector<uint64_t> codes(n);
+#pragma omp parallel for
+    for (int f = 0; f < n; f++) {
+        Eigen::Vector3i cell;
+        for (int d = 0; d < 3; d++) {
+            cell[d] = (int)((*particles)[f].pos[d] / dx - 0.5);
+        }
+        codes[f] = mortonCode(cell);
+    }
+
+    std::vector<int> order;
+    sortCodes(codes, &order);
+    applyOrder(order, particles);
+}
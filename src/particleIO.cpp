@@ -0,0 +1,560 @@
+#include "crackExtraction/particleIO.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <omp.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mappedFile::mappedFile(const std::string& path)
+{
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        length = (size_t)st.st_size;
+        if (length == 0) {
+            isValid = true;
+        } else {
+            void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                madvise(addr, length, MADV_SEQUENTIAL);
+                begin = (const char*)addr;
+                isMapped = true;
+                isValid = true;
+            }
+        }
+    }
+    close(fd);
+
+    if (isValid) {
+        return;
+    }
+#endif
+
+    // fall back to reading the whole file into memory
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return;
+    }
+    length = (size_t)in.tellg();
+    in.seekg(0);
+    storage.resize(length);
+    if (length > 0 && !in.read(storage.data(), length)) {
+        length = 0;
+        return;
+    }
+    begin = storage.data();
+    isValid = true;
+}
+
+mappedFile::~mappedFile()
+{
+#ifndef _WIN32
+    if (isMapped) {
+        munmap((void*)begin, length);
+    }
+#endif
+}
+
+// powers of ten that are exactly representable as doubles
+static const double exactPowersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Parse a floating point number starting at "p" and advance "p" past it. Behaves like atof on malformed input.
+double scanDouble(const char*& p, const char* end)
+{
+    const char* start = p;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+
+    while (p != end && isDigit(*p)) {
+        anyDigit = true;
+        if (significantDigits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa != 0) {
+                significantDigits += 1;
+            }
+        } else {
+            exponent += 1;
+        }
+        ++p;
+    }
+
+    if (p != end && *p == '.') {
+        ++p;
+        while (p != end && isDigit(*p)) {
+            anyDigit = true;
+            if (significantDigits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa != 0) {
+                    significantDigits += 1;
+                }
+                exponent -= 1;
+            }
+            ++p;
+        }
+    }
+
+    if (anyDigit && p != end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = false;
+        if (q != end && (*q == '-' || *q == '+')) {
+            negativeExponent = (*q == '-');
+            ++q;
+        }
+        if (q != end && isDigit(*q)) {
+            int e = 0;
+            while (q != end && isDigit(*q)) {
+                if (e < 100000) {
+                    e = e * 10 + (*q - '0');
+                }
+                ++q;
+            }
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    // fast path: the mantissa and the power of ten are both exact, so a single multiplication or division rounds correctly.
+    // Tokens continuing with letters (hexadecimal floats, "inf", ...) are left to strtod.
+    bool plainToken = (p == end || !((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')));
+    if (anyDigit && plainToken && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / exactPowersOf10[-exponent] : value * exactPowersOf10[exponent];
+        return negative ? -value : value;
+    }
+
+    // slow path: long mantissas, large exponents, inf, nan and malformed tokens are handled by strtod
+    char token[128];
+    p = start;
+    size_t n = 0;
+    while (p != end && !isBlank(*p) && *p != '\n' && n < sizeof(token) - 1) {
+        token[n++] = *p++;
+    }
+    token[n] = '\0';
+    return std::strtod(token, nullptr);
+}
+
+// identifies the binary particle frame format
+static const char particleFileMagic[8] = { 'C', 'R', 'K', 'P', 'A', 'R', 'T', '\0' };
+
+// Read the arrays of a binary particle frame. The bounding box is taken from the header.
+static bool loadParticlesBinary(std::ifstream& in, const particleFileHeader& header, ParticleBuffer* particles)
+{
+    // the later stages index particles with int
+    if (header.version != 1 || header.precision > 1 || header.count > (uint64_t)INT_MAX) {
+        return false;
+    }
+
+    // the count comes from the file, so it is checked against the rest of the stream before anything is allocated
+    std::streampos payloadBegin = in.tellg();
+    in.seekg(0, std::ios::end);
+    std::streampos payloadEnd = in.tellg();
+    in.seekg(payloadBegin);
+    size_t valueSize = header.precision == 0 ? sizeof(double) : sizeof(float);
+    if (!in || payloadEnd < payloadBegin || header.count > (uint64_t)(payloadEnd - payloadBegin) / (4 * valueSize)) {
+        return false;
+    }
+
+    size_t count = (size_t)header.count;
+    std::vector<double>* arrays[4] = { &(*particles).x, &(*particles).y, &(*particles).z, &(*particles).damage };
+    std::vector<float> singlePrecision;
+    for (int a = 0; a < 4; a++) {
+        (*arrays[a]).resize(count);
+        if (count == 0) {
+            continue;
+        }
+
+        if (header.precision == 0) {
+            if (!in.read((char*)(*arrays[a]).data(), count * sizeof(double))) {
+                return false;
+            }
+        } else {
+            singlePrecision.resize(count);
+            if (!in.read((char*)singlePrecision.data(), count * sizeof(float))) {
+                return false;
+            }
+            std::copy(singlePrecision.begin(), singlePrecision.end(), (*arrays[a]).begin());
+        }
+    }
+
+    (*particles).damageHistogram.assign(damageHistogramBins, 0);
+    for (size_t i = 0; i < count; i++) {
+        (*particles).damageHistogram[damageHistogramBin((*particles).damage[i])] += 1;
+    }
+
+    (*particles).minCoordinate = { header.minCoordinate[0], header.minCoordinate[1], header.minCoordinate[2] };
+    (*particles).maxCoordinate = { header.maxCoordinate[0], header.maxCoordinate[1], header.maxCoordinate[2] };
+    (*particles).dx = header.dx;
+
+    return true;
+}
+
+// number of particle records (lines containing anything but blanks) in a newline-aligned range of the text file
+static size_t countParticleLines(const char* p, const char* end)
+{
+    size_t count = 0;
+    bool content = false;
+    for (; p != end; ++p) {
+        if (*p == '\n') {
+            count += content ? 1 : 0;
+            content = false;
+        } else if (!isBlank(*p)) {
+            content = true;
+        }
+    }
+    return count + (content ? 1 : 0);
+}
+
+// bounding box and damage histogram of the particles handled by one thread
+struct particleChunkStatistics {
+    Eigen::Vector3d minCoordinate = Eigen::Vector3d::Constant(1.0E100);
+    Eigen::Vector3d maxCoordinate = Eigen::Vector3d::Constant(-1.0E100);
+    std::vector<size_t> damageHistogram = std::vector<size_t>(damageHistogramBins, 0);
+
+    void add(double x, double y, double z, double damage)
+    {
+        minCoordinate = { std::min(minCoordinate[0], x), std::min(minCoordinate[1], y), std::min(minCoordinate[2], z) };
+        maxCoordinate = { std::max(maxCoordinate[0], x), std::max(maxCoordinate[1], y), std::max(maxCoordinate[2], z) };
+        damageHistogram[damageHistogramBin(damage)] += 1;
+    }
+};
+
+// Merge the statistics of all chunks
+static void mergeChunkStatistics(const std::vector<particleChunkStatistics>& stats, Eigen::Vector3d* minCoordinate, Eigen::Vector3d* maxCoordinate, std::vector<size_t>* damageHistogram)
+{
+    (*damageHistogram).assign(damageHistogramBins, 0);
+    Eigen::Vector3d chunkMin = Eigen::Vector3d::Constant(1.0E100);
+    Eigen::Vector3d chunkMax = Eigen::Vector3d::Constant(-1.0E100);
+    size_t numParticles = 0;
+    for (int c = 0; c < (int)stats.size(); c++) {
+        chunkMin = chunkMin.cwiseMin(stats[c].minCoordinate);
+        chunkMax = chunkMax.cwiseMax(stats[c].maxCoordinate);
+        for (int b = 0; b < damageHistogramBins; b++) {
+            (*damageHistogram)[b] += stats[c].damageHistogram[b];
+            numParticles += stats[c].damageHistogram[b];
+        }
+    }
+
+    if (numParticles != 0) {
+        *minCoordinate = chunkMin;
+        *maxCoordinate = chunkMax;
+    }
+}
+
+// Parse the particle records of a newline-aligned range of the text file. Each record is handed to "emit" together
+// with its index, which starts at "offset".
+template <class particleSink>
+static void parseParticleLines(const char* p, const char* end, size_t offset, particleSink& emit, particleChunkStatistics* stats)
+{
+    size_t n = offset;
+    while (p < end) {
+        double value[4] = { 0, 0, 0, 0 };
+        int numValues = 0;
+        while (numValues < 4) {
+            while (p != end && isBlank(*p)) {
+                ++p;
+            }
+            if (p == end || *p == '\n') {
+                break;
+            }
+            value[numValues++] = scanDouble(p, end);
+
+            // skip anything atof would have ignored, e.g. trailing characters of a malformed token
+            while (p != end && !isBlank(*p) && *p != '\n') {
+                ++p;
+            }
+        }
+
+        // move to the next line
+        const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+        p = (lineEnd == nullptr) ? end : lineEnd + 1;
+
+        if (numValues == 0) {
+            continue; // blank line
+        }
+
+        emit(n, value[0], value[1], value[2], value[3]);
+        (*stats).add(value[0], value[1], value[2], value[3]);
+        n += 1;
+    }
+}
+
+// Split the text file into newline-aligned byte ranges, one per thread, and count the particle records in each of them.
+// Returns the total number of particles; chunk c holds the records [chunkOffset[c], chunkOffset[c + 1]).
+static size_t splitParticleText(const mappedFile& file, std::vector<const char*>* chunkBegin, std::vector<size_t>* chunkOffset)
+{
+    const char* data = file.data();
+    size_t size = file.size();
+
+    // small files are not worth splitting
+    int numChunks = size < (size_t(1) << 20) ? 1 : omp_get_max_threads();
+
+    (*chunkBegin).assign(numChunks + 1, data + size);
+    (*chunkBegin)[0] = data;
+    for (int c = 1; c < numChunks; c++) {
+        const char* p = std::max((*chunkBegin)[c - 1], data + size / numChunks * c);
+        const char* lineEnd = (const char*)memchr(p, '\n', data + size - p);
+        (*chunkBegin)[c] = (lineEnd == nullptr) ? data + size : lineEnd + 1;
+    }
+
+    (*chunkOffset).assign(numChunks + 1, 0);
+#pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numChunks; c++) {
+        (*chunkOffset)[c + 1] = countParticleLines((*chunkBegin)[c], (*chunkBegin)[c + 1]);
+    }
+    for (int c = 0; c < numChunks; c++) {
+        (*chunkOffset)[c + 1] += (*chunkOffset)[c];
+    }
+
+    return (*chunkOffset)[numChunks];
+}
+
+// writes parsed particles into the arrays of a particle buffer
+struct particleBufferSink {
+    ParticleBuffer* particles;
+
+    void operator()(size_t n, double x, double y, double z, double damage)
+    {
+        (*particles).x[n] = x;
+        (*particles).y[n] = y;
+        (*particles).z[n] = z;
+        (*particles).damage[n] = damage;
+    }
+};
+
+// Parse the four-column particle text file (x, y, z, damage) and compute its bounding box in the same pass.
+// The file is split into newline-aligned byte ranges which are counted and then parsed in parallel.
+static bool loadParticlesText(const std::string& path, ParticleBuffer* particles)
+{
+    mappedFile file(path);
+    if (!file.valid()) {
+        return false;
+    }
+
+    std::vector<const char*> chunkBegin;
+    std::vector<size_t> chunkOffset;
+    size_t numParticles = splitParticleText(file, &chunkBegin, &chunkOffset);
+    int numChunks = (int)chunkOffset.size() - 1;
+
+    (*particles).x.resize(numParticles);
+    (*particles).y.resize(numParticles);
+    (*particles).z.resize(numParticles);
+    (*particles).damage.resize(numParticles);
+
+    std::vector<particleChunkStatistics> stats(numChunks);
+#pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numChunks; c++) {
+        particleBufferSink sink = { particles };
+        parseParticleLines(chunkBegin[c], chunkBegin[c + 1], chunkOffset[c], sink, &stats[c]);
+    }
+
+    mergeChunkStatistics(stats, &(*particles).minCoordinate, &(*particles).maxCoordinate, &(*particles).damageHistogram);
+
+    return true;
+}
+
+// classifies parsed particles for the extraction
+struct particleSetsSink {
+    particleSets* sets;
+    size_t* numFullyDamaged; // fully damaged particles of the current chunk
+    double damageThreshold;
+
+    void operator()(size_t n, double x, double y, double z, double damage)
+    {
+        Eigen::Vector3d pos = { x, y, z };
+        bool fullyDamaged = damage >= damageThreshold;
+        (*sets).all[n] = DamageParticle(pos, fullyDamaged ? 1 : 0);
+        *numFullyDamaged += fullyDamaged ? 1 : 0;
+    }
+};
+
+// total number of fully damaged particles found by the chunks
+static size_t sumFullyDamaged(const std::vector<size_t>& chunkFullyDamaged)
+{
+    size_t numFullyDamaged = 0;
+    for (int c = 0; c < (int)chunkFullyDamaged.size(); c++) {
+        numFullyDamaged += chunkFullyDamaged[c];
+    }
+    return numFullyDamaged;
+}
+
+// Classify the particles of a memory mapped binary frame
+template <class real>
+static void ingestParticlesBinary(const particleFileHeader& header, const char* payload, double damageThreshold, particleSets* sets)
+{
+    size_t count = (size_t)header.count;
+    const real* x = (const real*)payload;
+    const real* y = x + count;
+    const real* z = y + count;
+    const real* damage = z + count;
+
+    int numChunks = omp_get_max_threads();
+    std::vector<size_t> chunkFullyDamaged(numChunks, 0);
+    std::vector<particleChunkStatistics> stats(numChunks);
+#pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numChunks; c++) {
+        particleSetsSink sink = { sets, &chunkFullyDamaged[c], damageThreshold };
+        for (size_t i = count * c / numChunks; i < count * (c + 1) / numChunks; i++) {
+            sink(i, x[i], y[i], z[i], damage[i]);
+            stats[c].damageHistogram[damageHistogramBin(damage[i])] += 1;
+        }
+    }
+
+    (*sets).numFullyDamaged = sumFullyDamaged(chunkFullyDamaged);
+    mergeChunkStatistics(stats, &(*sets).minCoordinate, &(*sets).maxCoordinate, &(*sets).damageHistogram);
+    (*sets).minCoordinate = { header.minCoordinate[0], header.minCoordinate[1], header.minCoordinate[2] };
+    (*sets).maxCoordinate = { header.maxCoordinate[0], header.maxCoordinate[1], header.maxCoordinate[2] };
+    (*sets).dx = header.dx;
+}
+
+// Read a particle file and classify each particle against the damage threshold while it is read
+bool ingestParticles(std::string path, double damageThreshold, particleSets* sets)
+{
+    mappedFile file(path);
+    if (!file.valid()) {
+        return false;
+    }
+
+    Eigen::Vector3d zero = { 0, 0, 0 };
+
+    // binary frame
+    particleFileHeader header;
+    if (file.size() >= sizeof(header) && memcmp(file.data(), particleFileMagic, sizeof(particleFileMagic)) == 0) {
+        memcpy(&header, file.data(), sizeof(header));
+        // the count comes from the file, so it is checked against the payload without multiplying it. The later stages
+        // index particles with int
+        size_t valueSize = header.precision == 0 ? sizeof(double) : sizeof(float);
+        if (header.version != 1 || header.precision > 1 || header.count > (uint64_t)INT_MAX || header.count > (file.size() - sizeof(header)) / (4 * valueSize)) {
+            return false;
+        }
+
+        (*sets).all.assign((size_t)header.count, DamageParticle(zero, 1));
+        if (header.precision == 0) {
+            ingestParticlesBinary<double>(header, file.data() + sizeof(header), damageThreshold, sets);
+        } else {
+            ingestParticlesBinary<float>(header, file.data() + sizeof(header), damageThreshold, sets);
+        }
+        return true;
+    }
+
+    // text file
+    std::vector<const char*> chunkBegin;
+    std::vector<size_t> chunkOffset;
+    size_t numParticles = splitParticleText(file, &chunkBegin, &chunkOffset);
+    int numChunks = (int)chunkOffset.size() - 1;
+
+    (*sets).all.assign(numParticles, DamageParticle(zero, 1));
+
+    std::vector<size_t> chunkFullyDamaged(numChunks, 0);
+    std::vector<particleChunkStatistics> stats(numChunks);
+#pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < numChunks; c++) {
+        particleSetsSink sink = { sets, &chunkFullyDamaged[c], damageThreshold };
+        parseParticleLines(chunkBegin[c], chunkBegin[c + 1], chunkOffset[c], sink, &stats[c]);
+    }
+
+    (*sets).numFullyDamaged = sumFullyDamaged(chunkFullyDamaged);
+    mergeChunkStatistics(stats, &(*sets).minCoordinate, &(*sets).maxCoordinate, &(*sets).damageHistogram);
+
+    return true;
+}
+
+// Read a particle file into a structure of arrays buffer. Binary frames are detected by their header and read in bulk,
+// otherwise the file is parsed as four-column text (x, y, z, damage) and its bounding box is computed while parsing
+bool loadParticles(std::string path, ParticleBuffer* particles)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    particleFileHeader header;
+    if (in.read((char*)&header, sizeof(header)) && memcmp(header.magic, particleFileMagic, sizeof(particleFileMagic)) == 0) {
+        return loadParticlesBinary(in, header, particles);
+    }
+    in.close();
+
+    return loadParticlesText(path, particles);
+}
+
+// Write particles in the binary frame format, optionally in single precision
+bool saveParticlesBinary(std::string path, const ParticleBuffer& particles, bool singlePrecision)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    particleFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, particleFileMagic, sizeof(particleFileMagic));
+    header.version = 1;
+    header.precision = singlePrecision ? 1 : 0;
+    header.count = particles.size();
+    header.dx = particles.dx;
+    for (int d = 0; d < 3; d++) {
+        header.minCoordinate[d] = particles.minCoordinate[d];
+        header.maxCoordinate[d] = particles.maxCoordinate[d];
+    }
+
+    // the bounding box has to describe the stored values, which are rounded in single precision
+    if (singlePrecision && particles.size() != 0) {
+        const std::vector<double>* position[3] = { &particles.x, &particles.y, &particles.z };
+        for (int d = 0; d < 3; d++) {
+            header.minCoordinate[d] = (float)(*position[d])[0];
+            header.maxCoordinate[d] = (float)(*position[d])[0];
+            for (size_t i = 0; i < particles.size(); i++) {
+                header.minCoordinate[d] = std::min(header.minCoordinate[d], (double)(float)(*position[d])[i]);
+                header.maxCoordinate[d] = std::max(header.maxCoordinate[d], (double)(float)(*position[d])[i]);
+            }
+        }
+    }
+
+    out.write((const char*)&header, sizeof(header));
+
+    const std::vector<double>* arrays[4] = { &particles.x, &particles.y, &particles.z, &particles.damage };
+    std::vector<float> converted;
+    for (int a = 0; a < 4; a++) {
+        if (singlePrecision) {
+            converted.assign((*arrays[a]).begin(), (*arrays[a]).end());
+            out.write((const char*)converted.data(), converted.size() * sizeof(float));
+        } else {
+            out.write((const char*)(*arrays[a]).data(), (*arrays[a]).size() * sizeof(double));
+        }
+    }
+
+    return (bool)out;
+}
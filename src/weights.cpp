@@ -1,32 +1,300 @@
 ﻿#include "crackExtraction/weights.h"
 #include <iostream>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WEIGHTS_X86_SIMD
+#include <immintrin.h>
+#endif
+
 // calculate the weight and derivative of particles
 struct weightAndDreri calWeight(double dx, Eigen::Vector3d pos)
 {
-    Eigen::Vector3d base = pos / dx - Eigen::Vector3d::Constant(0.5);
-    Eigen::Vector3i ppIndex = base.cast<int>();
-    Eigen::Vector3d space = pos / dx - ppIndex.cast<double>();
+    struct weightAndDreri res;
+    calWeights(dx, &pos, 1, &res);
+
+    return res;
+};
+
+// calculate the weights of n points at once
+void calWeights(double dx, const Eigen::Vector3d* pos, int n, struct weightAndDreri* res)
+{
+    const int capacity = weightBatch::capacity;
+    double x[capacity], y[capacity], z[capacity];
+    weightBatch batch;
+
+    for (int start = 0; start < n; start += capacity) {
+        int m = std::min(capacity, n - start);
+        for (int p = 0; p < m; p++) {
+            x[p] = pos[start + p][0];
+            y[p] = pos[start + p][1];
+            z[p] = pos[start + p][2];
+        }
+        calWeightBatch(dx, x, y, z, m, &batch);
+
+        for (int p = 0; p < m; p++) {
+            for (int d = 0; d < 3; d++) {
+                res[start + p].ppIndex[d] = batch.ppIndex[d][p];
+                res[start + p].space[d] = batch.space[d][p];
+                for (int i = 0; i < 3; i++) {
+                    res[start + p].weight(d, i) = batch.weight[d][i][p];
+                    res[start + p].deltaWeight(d, i) = batch.deltaWeight[d][i][p];
+                }
+            }
+        }
+    }
+};
+
+// weights of point p along one axis
+template <class real>
+static inline void calWeightAxisPoint(real dx, const real* coord, int p, int* ppIndex, real* space, real (*weight)[weightBatch::capacity], real (*deltaWeight)[weightBatch::capacity])
+{
+    real scaled = coord[p] / dx;
+    int base = (int)(scaled - real(0.5));
+    real s = scaled - (real)base;
 
-    /*std::cout << ppIndex[0] << " " << ppIndex[1] << " " << ppIndex[2] << " " << std::endl;*/
+    ppIndex[p] = base;
+    space[p] = s;
 
     // calculate weight
-    Eigen::Vector3d col0 = 0.5 * (Eigen::Vector3d::Constant(1.5) - space).array().square();
-    Eigen::Vector3d col1 = 0.75 - (Eigen::Vector3d::Constant(1.0) - space).array().square();
-    Eigen::Vector3d col2 = 0.5 * (Eigen::Vector3d::Constant(0.5) - space).array().square();
+    weight[0][p] = real(0.5) * ((real(1.5) - s) * (real(1.5) - s));
+    weight[1][p] = real(0.75) - (real(1.0) - s) * (real(1.0) - s);
+    weight[2][p] = real(0.5) * ((real(0.5) - s) * (real(0.5) - s));
 
     // calculate weight derivative
-    Eigen::Vector3d deltaWeightcol0 = (space - Eigen::Vector3d::Constant(1.5)) / dx;
-    Eigen::Vector3d deltaWeightcol1 = -2 * (space - Eigen::Vector3d::Constant(1.0)) / dx;
-    Eigen::Vector3d deltaWeightcol2 = (space - Eigen::Vector3d::Constant(0.5)) / dx;
+    deltaWeight[0][p] = (s - real(1.5)) / dx;
+    deltaWeight[1][p] = real(-2) * (s - real(1.0)) / dx;
+    deltaWeight[2][p] = (s - real(0.5)) / dx;
+}
 
-    Eigen::MatrixXd weight(3, 3);
-    weight << col0, col1, col2;
+// quadratic B-spline weights of one coordinate
+template <class real>
+void quadraticKernel::axis(real dx, real coord, int* base, real* weight, real* deltaWeight)
+{
+    real scaled = coord / dx;
+    *base = (int)(scaled - real(0.5));
+    real s = scaled - (real)*base;
 
-    Eigen::MatrixXd deltaWeight(3, 3);
-    deltaWeight << deltaWeightcol0, deltaWeightcol1, deltaWeightcol2;
+    weight[0] = real(0.5) * ((real(1.5) - s) * (real(1.5) - s));
+    weight[1] = real(0.75) - (real(1.0) - s) * (real(1.0) - s);
+    weight[2] = real(0.5) * ((real(0.5) - s) * (real(0.5) - s));
 
-    struct weightAndDreri res(ppIndex, space, weight, deltaWeight);
+    deltaWeight[0] = (s - real(1.5)) / dx;
+    deltaWeight[1] = real(-2) * (s - real(1.0)) / dx;
+    deltaWeight[2] = (s - real(0.5)) / dx;
+}
 
-    return res;
+template void quadraticKernel::axis<double>(double, double, int*, double*, double*);
+template void quadraticKernel::axis<float>(float, float, int*, float*, float*);
+
+// weights of n points along one axis
+template <class real>
+using weightAxisKernel = void (*)(real, const real*, int, int*, real*, real (*)[weightBatch::capacity], real (*)[weightBatch::capacity]);
+
+template <class real>
+static void calWeightAxisScalar(real dx, const real* coord, int n, int* ppIndex, real* space, real (*weight)[weightBatch::capacity], real (*deltaWeight)[weightBatch::capacity])
+{
+    for (int p = 0; p < n; p++) {
+        calWeightAxisPoint(dx, coord, p, ppIndex, space, weight, deltaWeight);
+    }
+}
+
+#ifdef WEIGHTS_X86_SIMD
+// four points per instruction. The operations are the same as in calWeightAxisPoint, so the rounding is identical
+__attribute__((target("avx2"))) static void calWeightAxisAVX2(double dx, const double* coord, int n, int* ppIndex, double* space, double (*weight)[weightBatch::capacity], double (*deltaWeight)[weightBatch::capacity])
+{
+    const __m256d vdx = _mm256_set1_pd(dx);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d oneHalf = _mm256_set1_pd(1.5);
+    const __m256d threeQuarters = _mm256_set1_pd(0.75);
+    const __m256d minusTwo = _mm256_set1_pd(-2.0);
+
+    int p = 0;
+    for (; p + 4 <= n; p += 4) {
+        __m256d scaled = _mm256_div_pd(_mm256_loadu_pd(coord + p), vdx);
+        __m128i base = _mm256_cvttpd_epi32(_mm256_sub_pd(scaled, half));
+        __m256d s = _mm256_sub_pd(scaled, _mm256_cvtepi32_pd(base));
+
+        _mm_storeu_si128((__m128i*)(ppIndex + p), base);
+        _mm256_storeu_pd(space + p, s);
+
+        __m256d a = _mm256_sub_pd(oneHalf, s);
+        __m256d b = _mm256_sub_pd(one, s);
+        __m256d c = _mm256_sub_pd(half, s);
+        _mm256_storeu_pd(weight[0] + p, _mm256_mul_pd(half, _mm256_mul_pd(a, a)));
+        _mm256_storeu_pd(weight[1] + p, _mm256_sub_pd(threeQuarters, _mm256_mul_pd(b, b)));
+        _mm256_storeu_pd(weight[2] + p, _mm256_mul_pd(half, _mm256_mul_pd(c, c)));
+
+        _mm256_storeu_pd(deltaWeight[0] + p, _mm256_div_pd(_mm256_sub_pd(s, oneHalf), vdx));
+        _mm256_storeu_pd(deltaWeight[1] + p, _mm256_div_pd(_mm256_mul_pd(minusTwo, _mm256_sub_pd(s, one)), vdx));
+        _mm256_storeu_pd(deltaWeight[2] + p, _mm256_div_pd(_mm256_sub_pd(s, half), vdx));
+    }
+    for (; p < n; p++) {
+        calWeightAxisPoint(dx, coord, p, ppIndex, space, weight, deltaWeight);
+    }
+}
+
+// eight points per instruction
+__attribute__((target("avx512f"))) static void calWeightAxisAVX512(double dx, const double* coord, int n, int* ppIndex, double* space, double (*weight)[weightBatch::capacity], double (*deltaWeight)[weightBatch::capacity])
+{
+    const __m512d vdx = _mm512_set1_pd(dx);
+    const __m512d half = _mm512_set1_pd(0.5);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d oneHalf = _mm512_set1_pd(1.5);
+    const __m512d threeQuarters = _mm512_set1_pd(0.75);
+    const __m512d minusTwo = _mm512_set1_pd(-2.0);
+
+    int p = 0;
+    for (; p + 8 <= n; p += 8) {
+        __m512d scaled = _mm512_div_pd(_mm512_loadu_pd(coord + p), vdx);
+        __m256i base = _mm512_cvttpd_epi32(_mm512_sub_pd(scaled, half));
+        __m512d s = _mm512_sub_pd(scaled, _mm512_cvtepi32_pd(base));
+
+        _mm256_storeu_si256((__m256i*)(ppIndex + p), base);
+        _mm512_storeu_pd(space + p, s);
+
+        __m512d a = _mm512_sub_pd(oneHalf, s);
+        __m512d b = _mm512_sub_pd(one, s);
+        __m512d c = _mm512_sub_pd(half, s);
+        _mm512_storeu_pd(weight[0] + p, _mm512_mul_pd(half, _mm512_mul_pd(a, a)));
+        _mm512_storeu_pd(weight[1] + p, _mm512_sub_pd(threeQuarters, _mm512_mul_pd(b, b)));
+        _mm512_storeu_pd(weight[2] + p, _mm512_mul_pd(half, _mm512_mul_pd(c, c)));
+
+        _mm512_storeu_pd(deltaWeight[0] + p, _mm512_div_pd(_mm512_sub_pd(s, oneHalf), vdx));
+        _mm512_storeu_pd(deltaWeight[1] + p, _mm512_div_pd(_mm512_mul_pd(minusTwo, _mm512_sub_pd(s, one)), vdx));
+        _mm512_storeu_pd(deltaWeight[2] + p, _mm512_div_pd(_mm512_sub_pd(s, half), vdx));
+    }
+    for (; p < n; p++) {
+        calWeightAxisPoint(dx, coord, p, ppIndex, space, weight, deltaWeight);
+    }
+}
+
+// eight single precision points per instruction
+__attribute__((target("avx2"))) static void calWeightAxisAVX2F(float dx, const float* coord, int n, int* ppIndex, float* space, float (*weight)[weightBatch::capacity], float (*deltaWeight)[weightBatch::capacity])
+{
+    const __m256 vdx = _mm256_set1_ps(dx);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 oneHalf = _mm256_set1_ps(1.5f);
+    const __m256 threeQuarters = _mm256_set1_ps(0.75f);
+    const __m256 minusTwo = _mm256_set1_ps(-2.0f);
+
+    int p = 0;
+    for (; p + 8 <= n; p += 8) {
+        __m256 scaled = _mm256_div_ps(_mm256_loadu_ps(coord + p), vdx);
+        __m256i base = _mm256_cvttps_epi32(_mm256_sub_ps(scaled, half));
+        __m256 s = _mm256_sub_ps(scaled, _mm256_cvtepi32_ps(base));
+
+        _mm256_storeu_si256((__m256i*)(ppIndex + p), base);
+        _mm256_storeu_ps(space + p, s);
+
+        __m256 a = _mm256_sub_ps(oneHalf, s);
+        __m256 b = _mm256_sub_ps(one, s);
+        __m256 c = _mm256_sub_ps(half, s);
+        _mm256_storeu_ps(weight[0] + p, _mm256_mul_ps(half, _mm256_mul_ps(a, a)));
+        _mm256_storeu_ps(weight[1] + p, _mm256_sub_ps(threeQuarters, _mm256_mul_ps(b, b)));
+        _mm256_storeu_ps(weight[2] + p, _mm256_mul_ps(half, _mm256_mul_ps(c, c)));
+
+        _mm256_storeu_ps(deltaWeight[0] + p, _mm256_div_ps(_mm256_sub_ps(s, oneHalf), vdx));
+        _mm256_storeu_ps(deltaWeight[1] + p, _mm256_div_ps(_mm256_mul_ps(minusTwo, _mm256_sub_ps(s, one)), vdx));
+        _mm256_storeu_ps(deltaWeight[2] + p, _mm256_div_ps(_mm256_sub_ps(s, half), vdx));
+    }
+    for (; p < n; p++) {
+        calWeightAxisPoint(dx, coord, p, ppIndex, space, weight, deltaWeight);
+    }
+}
+
+// sixteen single precision points per instruction
+__attribute__((target("avx512f"))) static void calWeightAxisAVX512F(float dx, const float* coord, int n, int* ppIndex, float* space, float (*weight)[weightBatch::capacity], float (*deltaWeight)[weightBatch::capacity])
+{
+    const __m512 vdx = _mm512_set1_ps(dx);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 oneHalf = _mm512_set1_ps(1.5f);
+    const __m512 threeQuarters = _mm512_set1_ps(0.75f);
+    const __m512 minusTwo = _mm512_set1_ps(-2.0f);
+
+    int p = 0;
+    for (; p + 16 <= n; p += 16) {
+        __m512 scaled = _mm512_div_ps(_mm512_loadu_ps(coord + p), vdx);
+        __m512i base = _mm512_cvttps_epi32(_mm512_sub_ps(scaled, half));
+        __m512 s = _mm512_sub_ps(scaled, _mm512_cvtepi32_ps(base));
+
+        _mm512_storeu_si512((void*)(ppIndex + p), base);
+        _mm512_storeu_ps(space + p, s);
+
+        __m512 a = _mm512_sub_ps(oneHalf, s);
+        __m512 b = _mm512_sub_ps(one, s);
+        __m512 c = _mm512_sub_ps(half, s);
+        _mm512_storeu_ps(weight[0] + p, _mm512_mul_ps(half, _mm512_mul_ps(a, a)));
+        _mm512_storeu_ps(weight[1] + p, _mm512_sub_ps(threeQuarters, _mm512_mul_ps(b, b)));
+        _mm512_storeu_ps(weight[2] + p, _mm512_mul_ps(half, _mm512_mul_ps(c, c)));
+
+        _mm512_storeu_ps(deltaWeight[0] + p, _mm512_div_ps(_mm512_sub_ps(s, oneHalf), vdx));
+        _mm512_storeu_ps(deltaWeight[1] + p, _mm512_div_ps(_mm512_mul_ps(minusTwo, _mm512_sub_ps(s, one)), vdx));
+        _mm512_storeu_ps(deltaWeight[2] + p, _mm512_div_ps(_mm512_sub_ps(s, half), vdx));
+    }
+    for (; p < n; p++) {
+        calWeightAxisPoint(dx, coord, p, ppIndex, space, weight, deltaWeight);
+    }
+}
+#endif
+
+// the double and the single precision kernels of one instruction set
+struct weightKernelSet {
+    weightAxisKernel<double> doubleKernel = calWeightAxisScalar<double>;
+    weightAxisKernel<float> floatKernel = calWeightAxisScalar<float>;
+    const char* name = "scalar";
 };
+
+// pick the widest kernels the CPU supports
+static weightKernelSet selectWeightKernels()
+{
+    weightKernelSet kernels;
+#ifdef WEIGHTS_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.doubleKernel = calWeightAxisAVX512;
+        kernels.floatKernel = calWeightAxisAVX512F;
+        kernels.name = "AVX-512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        kernels.doubleKernel = calWeightAxisAVX2;
+        kernels.floatKernel = calWeightAxisAVX2F;
+        kernels.name = "AVX2";
+    }
+#endif
+    return kernels;
+}
+
+// the kernels are selected on first use
+static const weightKernelSet& weightKernels()
+{
+    static const weightKernelSet kernels = selectWeightKernels();
+    return kernels;
+}
+
+// calculate the weights of n <= weightBatch::capacity points given by their coordinates
+template <class real>
+static void calWeightBatchAxes(weightAxisKernel<real> kernel, real dx, const real* x, const real* y, const real* z, int n, weightBatchT<real>* res)
+{
+    const real* coord[3] = { x, y, z };
+    for (int d = 0; d < 3; d++) {
+        kernel(dx, coord[d], n, (*res).ppIndex[d], (*res).space[d], (*res).weight[d], (*res).deltaWeight[d]);
+    }
+}
+
+void calWeightBatch(double dx, const double* x, const double* y, const double* z, int n, weightBatch* res)
+{
+    calWeightBatchAxes(weightKernels().doubleKernel, dx, x, y, z, n, res);
+}
+
+void calWeightBatch(float dx, const float* x, const float* y, const float* z, int n, weightBatchF* res)
+{
+    calWeightBatchAxes(weightKernels().floatKernel, dx, x, y, z, n, res);
+}
+
+// name of the weight kernel selected for this CPU
+const char* weightKernelName()
+{
+    return weightKernels().name;
+}